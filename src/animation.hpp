@@ -5,59 +5,212 @@
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 
+#include <algorithm>
 #include <string>
 #include <vector>
 #include <map>
+#include <memory>
 
 #include "bone.hpp"
+#include "sampler.hpp"
 #include "model.hpp"
 
-struct AssimpNodeData
+// Playback state of one instance of a clip. Clips are immutable once loaded, so one
+// Animation can be shared, and sampled concurrently, by any number of animators.
+struct AnimationContext
 {
-	glm::mat4 transformation;
-	std::string name;
-	int childrenCount;
-	std::vector<AssimpNodeData> children;
+	std::vector<TrackCursor> cursors;
+	// Scratch of getNodeTransforms(), only the entries of the queried chains are touched
+	Pose queryPose;
+	std::vector<glm::mat4> queryTransforms;
+	std::vector<bool> queryMarks;
+	std::vector<int> queryNodes;
+	std::vector<int> queryTracks;
 };
 
+// What changes about a node over a clip. STATIC nodes have no track or a constant one, and
+// STATIC_CHAIN nodes are static along with all of their ancestors, so their model space
+// transform never changes either.
+enum NodeMotion { NODE_ANIMATED, NODE_STATIC, NODE_STATIC_CHAIN };
 
 class Animation
 {
 public:
-	Animation(const std::string& animationPath, Model* model)
+	Animation(const std::string& animationPath, Model* model, const ImportSettings& settings = ImportSettings())
 	{
 		Assimp::Importer importer;
 		const aiScene* scene = importer.ReadFile(animationPath, aiProcess_Triangulate);
 		assert(scene && scene->mRootNode);
-		if (scene->mNumAnimations == 0)
-			return;
-		aiAnimation* animation = scene->mAnimations[0];
-		duration = (float)animation->mDuration;
-		tps = (float)animation->mTicksPerSecond;
-		generateBoneTree(&rootNode, scene->mRootNode);
-		// Reset all root transformations
-		rootNode.transformation = glm::mat4(1.0f);
-		loadIntermediateBones(animation, model);
+		skeleton = model->skeleton;
+		rotationInterpolation = settings.rotationInterpolation;
+		if (scene->mNumAnimations > 0) {
+			aiAnimation* animation = scene->mAnimations[0];
+			duration = (float)animation->mDuration;
+			tps = (float)animation->mTicksPerSecond;
+			loadIntermediateBones(animation, model, settings);
+		}
+		bindSkeleton();
+		foldStaticNodes();
+
+		TrackError resampleError, reductionError, compressionError;
+		size_t memory = 0, uncompressedMemory = 0;
+		for (unsigned int i = 0; i < bones.size(); i++) {
+			nlerpError = glm::max(nlerpError, bones[i].getNlerpError());
+			scaleDeviation = glm::max(scaleDeviation, bones[i].getScaleDeviation());
+			accumulateError(resampleError, bones[i].getResampleError());
+			accumulateError(reductionError, bones[i].getReductionError());
+			keyCount += bones[i].getKeyCount();
+			removedKeyCount += bones[i].getRemovedKeyCount();
+			accumulateError(compressionError, bones[i].getCompressionError());
+			memory += bones[i].getMemoryUsage();
+			uncompressedMemory += bones[i].getUncompressedMemoryUsage();
+		}
+		cout << "Loaded animation: " << animationPath << ", nlerp error against slerp: " << glm::degrees(nlerpError) << " degrees" << endl;
+
+		if (settings.sampleRate > 0.0f) {
+			cout << "Resampled at " << settings.sampleRate << " keys per second, max error: position " << resampleError.position
+				<< ", rotation " << glm::degrees(resampleError.rotation) << " degrees, scale " << resampleError.scale << endl;
+		}
+
+		if (removedKeyCount > 0) {
+			cout << "Removed " << removedKeyCount << " of " << keyCount + removedKeyCount << " keys, max error: position " << reductionError.position
+				<< ", rotation " << glm::degrees(reductionError.rotation) << " degrees, scale " << reductionError.scale << endl;
+		}
+
+		if (settings.compress) {
+			cout << "Compressed keys from " << uncompressedMemory << " to " << memory << " bytes (timestamps stay 32-bit floats, "
+				<< "the saving is mostly constant channels collapsed to one key), max error: position " << compressionError.position
+				<< ", rotation " << glm::degrees(compressionError.rotation) << " degrees, scale " << compressionError.scale << endl;
+		}
 	}
 
-	Bone* findBone(const std::string& name)
+	// Index of the track animating the node, -1 if the node keeps its bind transform
+	inline int getNodeTrack(int nodeIndex) const { return nodeTracks[nodeIndex]; }
+
+	inline int getTrackCount() const { return (int)bones.size(); }
+
+	// Sample the animated tracks at animationTime into a pose starting from getRestPose().
+	// Constant tracks are already folded into the rest pose and not sampled again.
+	void sample(float animationTime, Pose& pose, AnimationContext& context) const
 	{
-		for (unsigned int i = 0; i < bones.size(); i++) {
-			if (bones[i].getBoneName() == name) {
-				return &bones[i];
+		if (context.cursors.size() != bones.size())
+			context.cursors.assign(bones.size(), TrackCursor());
+		sampleBones(bones, trackNodes, animatedTracks.data(), animatedTracks.size(), animationTime, rotationInterpolation, context.cursors.data(), pose.data());
+	}
+
+	// Same as above for a list of animated tracks, see getNodeTracks()
+	void sample(float animationTime, Pose& pose, AnimationContext& context, const std::vector<int>& tracks) const
+	{
+		if (context.cursors.size() != bones.size())
+			context.cursors.assign(bones.size(), TrackCursor());
+		sampleBones(bones, trackNodes, tracks.data(), tracks.size(), animationTime, rotationInterpolation, context.cursors.data(), pose.data());
+	}
+
+	// Model space transforms of count nodes at animationTime. Only the nodes on the paths from
+	// the queried nodes to the root are sampled and composed, each once however many paths
+	// share it, so the cost follows the depth of the chains rather than the skeleton size.
+	// Nodes outside the skeleton, such as the -1 of Skeleton::findNode(), get the identity.
+	void getNodeTransforms(const int* nodes, size_t count, float animationTime, glm::mat4* transforms, AnimationContext& context) const
+	{
+		int nodeCount = skeleton->getNodeCount();
+		if (context.cursors.size() != bones.size())
+			context.cursors.assign(bones.size(), TrackCursor());
+		if ((int)context.queryMarks.size() != nodeCount) {
+			context.queryPose.resize(nodeCount);
+			context.queryTransforms.resize(nodeCount);
+			context.queryMarks.assign(nodeCount, false);
+		}
+
+		context.queryNodes.clear();
+		for (size_t i = 0; i < count; i++) {
+			if (nodes[i] < 0 || nodes[i] >= nodeCount)
+				continue;
+			for (int node = nodes[i]; node != -1 && !context.queryMarks[node]; node = skeleton->parents[node]) {
+				context.queryMarks[node] = true;
+				context.queryNodes.push_back(node);
 			}
 		}
-		return nullptr;
+		// Parents are stored before their children
+		std::sort(context.queryNodes.begin(), context.queryNodes.end());
+
+		context.queryTracks.clear();
+		for (int node : context.queryNodes) {
+			if (nodeMotion[node] == NODE_ANIMATED)
+				context.queryTracks.push_back(nodeTracks[node]);
+			else
+				context.queryPose[node] = restPose[node];
+		}
+		sampleBones(bones, trackNodes, context.queryTracks.data(), context.queryTracks.size(), animationTime, rotationInterpolation, context.cursors.data(), context.queryPose.data());
+
+		for (int node : context.queryNodes) {
+			glm::mat4 local = composeTransform(context.queryPose[node]);
+			int parent = skeleton->parents[node];
+			context.queryTransforms[node] = parent == -1 ? local : multiplyAffine(context.queryTransforms[parent], local);
+			context.queryMarks[node] = false;
+		}
+		for (size_t i = 0; i < count; i++)
+			transforms[i] = nodes[i] >= 0 && nodes[i] < nodeCount ? context.queryTransforms[nodes[i]] : glm::mat4(1.0f);
+	}
+
+	glm::mat4 getNodeTransform(int node, float animationTime, AnimationContext& context) const
+	{
+		glm::mat4 transform;
+		getNodeTransforms(&node, 1, animationTime, &transform, context);
+		return transform;
+	}
+
+	// Indices of the animated tracks of the nodes set in nodeMask, constant ones are in the rest pose
+	void getNodeTracks(const std::vector<bool>& nodeMask, std::vector<int>& tracks) const
+	{
+		tracks.clear();
+		for (int track : animatedTracks) {
+			if (trackNodes[track] != -1 && nodeMask[trackNodes[track]])
+				tracks.push_back(track);
+		}
 	}
 
+	// Bind pose with the constant tracks applied, every sampled pose of the clip starts from it
+	inline const Pose& getRestPose() const { return restPose; }
+
+	inline NodeMotion getNodeMotion(int nodeIndex) const { return (NodeMotion)nodeMotion[nodeIndex]; }
+
+	// Local matrix of a static node, and the model space matrix and palette entry of a static chain node
+	inline const glm::mat4& getRestLocalTransform(int nodeIndex) const { return restLocalTransforms[nodeIndex]; }
+
+	inline const glm::mat4& getRestGlobalTransform(int nodeIndex) const { return restGlobalTransforms[nodeIndex]; }
+
+	inline const glm::mat4& getRestBoneMatrix(int nodeIndex) const { return restBoneMatrices[nodeIndex]; }
+
+	inline int getAnimatedTrackCount() const { return (int)animatedTracks.size(); }
+
+	inline RotationInterpolation getRotationInterpolation() const { return rotationInterpolation; }
+
+	// Largest angle in radians by which nlerp deviates from slerp anywhere in the clip
+	inline float getNlerpError() const { return nlerpError; }
+
+	// Largest difference of any scale key from one. Dual quaternion skinning holds rotation and
+	// translation only, it drops uniform scale and cannot blend non-uniform scale.
+	inline float getScaleDeviation() const { return scaleDeviation; }
+
+	inline bool hasScaleKeys(float tolerance = 1e-4f) const { return scaleDeviation > tolerance; }
+
+	// Keys kept over all tracks, and the keys dropped by the reduction at import
+	inline size_t getKeyCount() const { return keyCount; }
+
+	inline size_t getRemovedKeyCount() const { return removedKeyCount; }
+
+	// Slot of the node in the final bone matrices, -1 if the node is not a skinned bone
+	inline int getNodePaletteIndex(int nodeIndex) const { return nodePalette[nodeIndex]; }
+
+	inline int getNodeCount() const { return (int)nodeTracks.size(); }
 
-	inline float getTicksPerSecond() { return tps; }
+	inline float getTicksPerSecond() const { return tps; }
 
-	inline float getDuration() { return duration; }
+	inline float getDuration() const { return duration; }
 
-	inline const AssimpNodeData* getRootNode() { return &rootNode; }
+	inline const Skeleton* getSkeleton() const { return skeleton.get(); }
 
-	inline const std::vector<BoneProps>& getBoneProps()
+	inline const std::vector<BoneProps>& getBoneProps() const
 	{
 		return boneProps;
 	}
@@ -65,13 +218,36 @@ public:
 private:
 	float duration = 0.0f;
 	float tps = 0.0f;
+	float nlerpError = 0.0f;
+	float scaleDeviation = 0.0f;
+	size_t keyCount = 0;
+	size_t removedKeyCount = 0;
+	RotationInterpolation rotationInterpolation = NLERP;
 	std::vector<Bone> bones;
-	AssimpNodeData rootNode;
+	std::shared_ptr<const Skeleton> skeleton;
 	std::vector<BoneProps> boneProps;
+	std::vector<int> nodeTracks;
+	std::vector<int> nodePalette;
+	std::vector<int> trackNodes;
+	// Results of foldStaticNodes()
+	std::vector<int> animatedTracks;
+	std::vector<char> nodeMotion;
+	Pose restPose;
+	std::vector<glm::mat4> restLocalTransforms;
+	std::vector<glm::mat4> restGlobalTransforms;
+	std::vector<glm::mat4> restBoneMatrices;
 
-	void loadIntermediateBones(const aiAnimation* animation, Model* model)
+	void loadIntermediateBones(const aiAnimation* animation, Model* model, const ImportSettings& settings)
 	{
 		auto& boneProps = model->boneProps;
+		// Errors of all joints along a chain add up, so each joint gets an equal share of the
+		// tolerance of the longest chain it is part of
+		std::vector<float> reach;
+		std::vector<int> chainLength;
+		if (settings.reductionTolerance > 0.0f) {
+			reach = skeleton->getNodeReach();
+			chainLength = skeleton->getNodeChainLength();
+		}
 
 		for (int i = 0; i < animation->mNumChannels; i++)
 		{
@@ -90,29 +266,82 @@ private:
 				if (boneId == -1) {
 					BoneProps boneProp;
 					boneProp.name = boneName;
+					// Not skinned by any mesh, keep the matrix affine for the palette multiply
+					boneProp.offset = glm::mat4(1.0f);
 					boneProps.push_back(boneProp);
 					boneId = boneProps.size() - 1;
 				}
 			}
-			bones.push_back(Bone(channel->mNodeName.data, boneId, channel));
+			int node = skeleton->findNode(boneName);
+			float jointTolerance = 0.0f, jointReach = 0.0f;
+			if (node != -1 && !reach.empty()) {
+				jointTolerance = settings.reductionTolerance / chainLength[node];
+				jointReach = reach[node];
+			}
+			bones.push_back(Bone(channel->mNodeName.data, boneId, channel, duration, tps, settings, jointTolerance, jointReach));
 		}
 
 		this->boneProps = boneProps;
 	}
 
-	void generateBoneTree(AssimpNodeData* parent, const aiNode* src)
+	// Resolve every node name once, so playback only deals with indices
+	void bindSkeleton()
 	{
-		assert(src);
+		nodeTracks.assign(skeleton->getNodeCount(), -1);
+		nodePalette.assign(skeleton->getNodeCount(), -1);
+		trackNodes.assign(bones.size(), -1);
+
+		for (unsigned int i = 0; i < bones.size(); i++) {
+			int node = skeleton->findNode(bones[i].getBoneName());
+			trackNodes[i] = node;
+			if (node != -1)
+				nodeTracks[node] = i;
+		}
 
-		parent->name = src->mName.data;
-		parent->transformation = aiMatrix4x4ToGlm(&src->mTransformation);
-		parent->childrenCount = src->mNumChildren;
+		for (unsigned int i = 0; i < boneProps.size(); i++) {
+			int node = skeleton->findNode(boneProps[i].name);
+			if (node != -1)
+				nodePalette[node] = i;
+		}
+	}
 
-		for (unsigned int i = 0; i < src->mNumChildren; i++)
-		{
-			AssimpNodeData newData;
-			generateBoneTree(&newData, src->mChildren[i]);
-			parent->children.push_back(newData);
+	// Sample the constant tracks once into the rest pose, and precompute what never changes
+	// about the static nodes: their local matrices, and the model space matrices and palette
+	// entries of whole static chains. Playback then only samples and composes moving nodes.
+	void foldStaticNodes()
+	{
+		int nodeCount = skeleton->getNodeCount();
+		restPose = skeleton->bindPose;
+		animatedTracks.clear();
+		std::vector<int> constantTracks;
+		for (unsigned int i = 0; i < bones.size(); i++) {
+			if (bones[i].isConstant())
+				constantTracks.push_back(i);
+			else
+				animatedTracks.push_back(i);
+		}
+		std::vector<TrackCursor> cursors(bones.size());
+		// Through the sampler, so the folded transforms are exactly what sampling would give
+		sampleBones(bones, trackNodes, constantTracks.data(), constantTracks.size(), 0.0f, rotationInterpolation, cursors.data(), restPose.data());
+
+		nodeMotion.assign(nodeCount, NODE_STATIC_CHAIN);
+		for (int track : animatedTracks) {
+			if (trackNodes[track] != -1)
+				nodeMotion[trackNodes[track]] = NODE_ANIMATED;
+		}
+
+		restLocalTransforms.resize(nodeCount);
+		restGlobalTransforms.resize(nodeCount);
+		restBoneMatrices.resize(nodeCount);
+		for (int node = 0; node < nodeCount; node++) {
+			int parent = skeleton->parents[node];
+			if (nodeMotion[node] != NODE_ANIMATED && parent != -1 && nodeMotion[parent] != NODE_STATIC_CHAIN)
+				nodeMotion[node] = NODE_STATIC;
+
+			restLocalTransforms[node] = composeTransform(restPose[node]);
+			restGlobalTransforms[node] = parent == -1 ? restLocalTransforms[node] : multiplyAffine(restGlobalTransforms[parent], restLocalTransforms[node]);
+			if (nodePalette[node] != -1)
+				restBoneMatrices[node] = multiplyAffine(restGlobalTransforms[node], boneProps[nodePalette[node]].offset);
 		}
 	}
 };
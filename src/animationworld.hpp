@@ -0,0 +1,95 @@
+#ifndef ANIMATIONWORLD_HPP
+#define ANIMATIONWORLD_HPP
+
+#include <glm/glm.hpp>
+
+#include <memory>
+#include <vector>
+
+#include "animator.hpp"
+#include "jobpool.hpp"
+
+// Owns the animators of every character and updates them in parallel. Each animator
+// writes into its own slot of one preallocated palette buffer, so the result does not
+// depend on the number of threads or on which thread updated which character.
+class AnimationWorld
+{
+public:
+	// capacity is the largest number of characters, threadCount 0 uses every hardware thread
+	AnimationWorld(size_t capacity, unsigned int threadCount = 0)
+		: pool(threadCount)
+	{
+		poseCache = nullptr;
+		palettes.assign(capacity * MAX_BONES, glm::mat4(1.0f));
+		animators.reserve(capacity);
+	}
+
+	// Add a character and return its instance index
+	int addAnimator()
+	{
+		assert(animators.size() < animators.capacity());
+		animators.push_back(std::unique_ptr<Animator>(new Animator()));
+		int instance = (int)animators.size() - 1;
+		animators[instance]->setPaletteStorage(&palettes[instance * MAX_BONES]);
+		animators[instance]->setPoseCache(poseCache);
+		return instance;
+	}
+
+	Animator& getAnimator(int instance) { return *animators[instance]; }
+
+	// MAX_BONES matrices of the character, valid until the next update
+	const glm::mat4* getPalette(int instance) const { return &palettes[instance * MAX_BONES]; }
+
+	// Palettes of all characters, one after another
+	const std::vector<glm::mat4>& getPalettes() const { return palettes; }
+
+	int getInstanceCount() const { return (int)animators.size(); }
+
+	// Let all characters, including those added later, share poses through the cache
+	void setPoseCache(PoseCache* cache)
+	{
+		poseCache = cache;
+		for (auto& animator : animators)
+			animator->setPoseCache(cache);
+	}
+
+	unsigned int getThreadCount() const { return pool.getThreadCount(); }
+
+	// LOD counters summed over all characters
+	LodStats getLodStats() const
+	{
+		LodStats total;
+		for (auto& animator : animators) {
+			const LodStats& stats = animator->getLodStats();
+			total.sampledUpdates += stats.sampledUpdates;
+			total.interpolatedUpdates += stats.interpolatedUpdates;
+			total.culledUpdates += stats.culledUpdates;
+			total.skippedTracks += stats.skippedTracks;
+		}
+		return total;
+	}
+
+	void resetLodStats()
+	{
+		for (auto& animator : animators)
+			animator->resetLodStats();
+	}
+
+	void updateAnimations(float dt)
+	{
+		auto update = [this, dt](size_t begin, size_t end) {
+			for (size_t instance = begin; instance < end; instance++)
+				animators[instance]->updateAnimation(dt);
+		};
+		// Small batches keep the threads busy until the end, while the cost of a job stays negligible
+		pool.parallelFor(animators.size(), 8, update);
+	}
+
+private:
+	JobPool pool;
+	std::vector<std::unique_ptr<Animator>> animators;
+	std::vector<glm::mat4> palettes;
+	PoseCache* poseCache;
+};
+
+#endif
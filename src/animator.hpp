@@ -2,23 +2,160 @@
 #define ANIMATOR_HPP
 
 #include "animation.hpp"
+#include "blend.hpp"
+#include "blendspace.hpp"
+#include "inertialization.hpp"
+#include "paletteformat.hpp"
+#include "posecache.hpp"
+
+// Matrices in the palette of an animator, the bones of a rig have to fit
+const int MAX_BONES = 100;
+
+// Animation level of detail. The lower levels sample a new pose only every 2, 4 or 8
+// updates, and in between rebuild the palette from a blend of the last two sampled poses.
+enum AnimationLod { LOD_FULL, LOD_HALF, LOD_QUARTER, LOD_EIGHTH };
+
+struct LodSettings
+{
+	// View distance from which each lower level is used
+	float halfRateDistance = 10.0f;
+	float quarterRateDistance = 20.0f;
+	float eighthRateDistance = 40.0f;
+	// From this level on, bones reaching less than minBoneReach (in skeleton units, see
+	// Skeleton::getNodeReach()) such as fingers and toes keep their bind pose
+	AnimationLod reducedSkeletonLod = LOD_QUARTER;
+	float minBoneReach = 10.0f;
+};
+
+// How playAnimation() moves to another clip. CROSSFADE blends the pose the old clip was left
+// at into the first frame of the new one. INERTIALIZE switches at once and lets the offset to
+// the old pose decay, so only the new clip is sampled.
+enum TransitionMode { CROSSFADE, INERTIALIZE };
+
+// Length of a transition in seconds
+const float TRANSITION_DURATION = 0.2f;
+
+// One clip of a blend, sampled at time (in ticks) and weighted against the others
+struct BlendInput
+{
+	const Animation* animation;
+	float time;
+	float weight;
+};
+
+// Clip played on part of the skeleton over the base animation, e.g. the upper body aiming
+// while the legs walk. The bone mask is compiled into the nodes it covers that the clip
+// animates and their tracks, so a layer samples only those tracks.
+struct AnimationLayer
+{
+	const Animation* animation;
+	std::vector<bool> nodeMask;
+	float weight;
+	float time;
+	std::vector<int> nodes;
+	std::vector<int> tracks;
+	AnimationContext context;
+};
+
+// Updates per kind since the last reset, and tracks left out by the reduced skeleton
+struct LodStats
+{
+	size_t sampledUpdates = 0;
+	size_t interpolatedUpdates = 0;
+	size_t culledUpdates = 0;
+	size_t skippedTracks = 0;
+};
 
 class Animator
 {
 private:
 	std::vector<glm::mat4> finalBoneMatrices;
-	Animation* currentAnimation;
-	Animation* nextAnimation;
-	Animation* queueAnimation;
+	// External storage for the palette, finalBoneMatrices is used when null
+	glm::mat4* palette;
+	// Layout the palette is handed to the shaders in
+	PaletteFormat paletteFormat;
+	std::vector<glm::mat4> globalTransforms;
+	Pose localPose;
+	// Whether the local pose is a single clip on its own, see calculateFinalBoneMatrices()
+	bool poseFolded;
+	AnimationContext context;
+	// Cursors and scratch of node queries, apart from playback
+	AnimationContext queryContext;
+	const Animation* currentAnimation;
+	const Animation* nextAnimation;
+	const Animation* queueAnimation;
 	float currentTime;
 	bool interpolating;
 	float haltTime;
 	float interTime;
 
+	// Both ends of the running transition, sampled once when it starts
+	Pose transitionFrom;
+	Pose transitionTo;
+	AnimationContext transitionContext;
+	const Animation* transitionSource;
+	const Animation* transitionTarget;
+	float transitionHaltTime;
+	bool transitionReduced;
+
+	TransitionMode transitionMode;
+	// Seconds since the switch of the running inertialization, and its decays
+	bool inertializing;
+	float inertialTime;
+	std::vector<InertialDecay> inertialDecays;
+	// Last two sampled poses with the clock time they were sampled for, to know the
+	// offset and velocity at a switch
+	float clock;
+	int outputPoseCount;
+	Pose outputPose;
+	Pose previousOutputPose;
+	float outputTime;
+	float previousOutputTime;
+
+	std::vector<AnimationLayer> layers;
+	// Masked nodes of a layer are sampled into this pose, the others are never read
+	Pose layerPose;
+
+	// Buffers of blendAnimations(), one per input
+	PosePool posePool;
+	std::vector<AnimationContext> blendContexts;
+	std::vector<Pose*> blendPoseList;
+	std::vector<float> blendWeights;
+
+	// Blend space played in place of a clip, with its parameter, the normalized time of the
+	// synchronized samples and the own time of every other sample
+	const BlendSpace* blendSpace;
+	glm::vec2 blendParameter;
+	float blendPhase;
+	std::vector<float> blendSampleTimes;
+	BlendWeights blendSpaceWeights;
+
+	// Shared poses of quantized times, sampled directly when null
+	PoseCache* poseCache;
+
+	AnimationLod lod;
+	bool culled;
+	LodSettings lodSettings;
+	LodStats lodStats;
+	// Updates since the last sampled pose, and the last two sampled local poses with whether
+	// both were the clip alone
+	int lodFrame;
+	bool lodPosesValid;
+	Pose previousLodPose;
+	Pose latestLodPose;
+	bool previousLodFolded;
+	bool latestLodFolded;
+	// Nodes kept on the reduced skeleton, and the tracks animating them in the last clip
+	const Skeleton* detailSkeleton;
+	std::vector<bool> detailNodes;
+	const Animation* detailAnimation;
+	std::vector<int> detailTracks;
+
 public:
 	Animator()
 	{
 		currentTime = 0.0;
+		poseFolded = false;
 		interpolating = false;
 		haltTime = 0.0;
 		interTime = 0.0;
@@ -26,22 +163,125 @@ public:
 		currentAnimation = nullptr;
 		nextAnimation = nullptr;
 		queueAnimation = nullptr;
+		palette = nullptr;
+		paletteFormat = PALETTE_MAT4;
+		transitionSource = nullptr;
+		transitionTarget = nullptr;
+		transitionHaltTime = 0.0f;
+		transitionReduced = false;
+
+		transitionMode = CROSSFADE;
+		inertializing = false;
+		inertialTime = 0.0f;
+		clock = 0.0f;
+		outputPoseCount = 0;
+		outputTime = 0.0f;
+		previousOutputTime = 0.0f;
+
+		blendSpace = nullptr;
+		blendParameter = glm::vec2(0.0f);
+		blendPhase = 0.0f;
+		blendSpaceWeights.count = 0;
+
+		poseCache = nullptr;
+
+		lod = LOD_FULL;
+		culled = false;
+		lodFrame = 0;
+		lodPosesValid = false;
+		previousLodFolded = false;
+		latestLodFolded = false;
+		detailSkeleton = nullptr;
+		detailAnimation = nullptr;
+
+		finalBoneMatrices.reserve(MAX_BONES);
+
+		for (int i = 0; i < MAX_BONES; i++)
+			finalBoneMatrices.push_back(glm::mat4(1.0f));
+	}
 
-		finalBoneMatrices.reserve(100);
+	// Write the palette into storage of MAX_BONES matrices owned by the caller
+	void setPaletteStorage(glm::mat4* storage)
+	{
+		palette = storage;
+		if (palette)
+			std::copy(finalBoneMatrices.begin(), finalBoneMatrices.end(), palette);
+	}
 
-		for (int i = 0; i < 100; i++)
-			finalBoneMatrices.push_back(glm::mat4(1.0f));
+	const glm::mat4* getPalette() const { return palette ? palette : finalBoneMatrices.data(); }
+
+	// The palette stays full matrices on the CPU, the format applies when it is encoded for the GPU
+	void setPaletteFormat(PaletteFormat format) { paletteFormat = format; }
+
+	PaletteFormat getPaletteFormat() const { return paletteFormat; }
+
+	// Share the poses of every clip through the cache, at the times it quantizes to. Reduced
+	// skeleton poses are cheap and still sampled directly. Null samples everything directly.
+	void setPoseCache(PoseCache* cache) { poseCache = cache; }
+
+	PoseCache* getPoseCache() const { return poseCache; }
+
+	void setLodSettings(const LodSettings& settings)
+	{
+		lodSettings = settings;
+		detailSkeleton = nullptr;
+		detailAnimation = nullptr;
 	}
 
+	// Pick the level of detail from the distance to the camera. Culled characters only advance their time.
+	void updateLod(float distance, bool visible)
+	{
+		if (distance >= lodSettings.eighthRateDistance)
+			lod = LOD_EIGHTH;
+		else if (distance >= lodSettings.quarterRateDistance)
+			lod = LOD_QUARTER;
+		else if (distance >= lodSettings.halfRateDistance)
+			lod = LOD_HALF;
+		else
+			lod = LOD_FULL;
+		culled = !visible;
+	}
+
+	void setLod(AnimationLod level) { lod = level; }
+
+	AnimationLod getLod() const { return lod; }
+
+	void setCulled(bool inCulled) { culled = inCulled; }
+
+	bool isCulled() const { return culled; }
+
+	const LodStats& getLodStats() const { return lodStats; }
+
+	void resetLodStats() { lodStats = LodStats(); }
+
 	void updateAnimation(float dt)
 	{
+		advanceLayers(dt);
+
+		if (blendSpace) {
+			updateBlendSpace(dt);
+			return;
+		}
+
 		if (currentAnimation) {
 			currentTime = fmod(currentTime + currentAnimation->getTicksPerSecond() * dt, currentAnimation->getDuration());
 
-			float transitionTime = currentAnimation->getTicksPerSecond() * 0.2f;
+			clock += dt;
+			if (inertializing)
+				inertialTime += dt;
+
+			float transitionTime = currentAnimation->getTicksPerSecond() * TRANSITION_DURATION;
 			if (interpolating && interTime <= transitionTime) {
 				interTime += currentAnimation->getTicksPerSecond() * dt;
-				calculateBoneTransition(currentAnimation->getRootNode(), glm::mat4(1.0f), currentAnimation, nextAnimation, haltTime, interTime, transitionTime);
+				int lookahead;
+				bool sampled = beginPose(lookahead);
+				if (sampled) {
+					float sampleTime = glm::min(interTime + lookahead * currentAnimation->getTicksPerSecond() * dt, glm::max(interTime, transitionTime));
+					calculateBoneTransition(currentAnimation, nextAnimation, haltTime, sampleTime, transitionTime);
+					poseFolded = false;
+					applyLayers(lookahead * dt, localPose);
+				}
+				finishPose(nextAnimation, sampled);
 				return;
 			}
 			else if (interpolating) {
@@ -61,17 +301,53 @@ public:
 				interTime = 0.0;
 			}
 
-			calculateBoneTransform(currentAnimation->getRootNode(), glm::mat4(1.0f), currentAnimation, currentTime);
+			int lookahead;
+			bool sampled = beginPose(lookahead);
+			if (sampled) {
+				float sampleTime = fmod(currentTime + lookahead * currentAnimation->getTicksPerSecond() * dt, currentAnimation->getDuration());
+				calculateBoneTransform(currentAnimation, sampleTime);
+				poseFolded = !inertializing && !hasActiveLayers();
+				applyLayers(lookahead * dt, localPose);
+				if (inertializing)
+					applyInertialization(inertialDecays, inertialTime + lookahead * dt, localPose);
+				if (transitionMode == INERTIALIZE)
+					recordOutputPose(clock + lookahead * dt);
+				else
+					outputPoseCount = 0;
+			}
+			else if (culled) {
+				outputPoseCount = 0;
+			}
+			finishPose(currentAnimation, sampled);
+
+			if (inertializing && inertialTime >= TRANSITION_DURATION)
+				inertializing = false;
 		}
 	}
 
-	void playAnimation(Animation* pAnimation, bool repeat = true)
+	void playAnimation(const Animation* pAnimation, bool repeat = true)
 	{
+		if (blendSpace) {
+			samplePose(pAnimation, 0.0f, transitionTo, transitionContext);
+			applyLayers(0.0f, transitionTo);
+			inertializeTo(transitionTo);
+			blendSpace = nullptr;
+			currentAnimation = pAnimation;
+			currentTime = 0.0f;
+			return;
+		}
+
 		if (!currentAnimation) {
 			currentAnimation = pAnimation;
 			return;
 		}
 
+		if (transitionMode == INERTIALIZE) {
+			if (pAnimation != currentAnimation)
+				startInertialization(pAnimation);
+			return;
+		}
+
 		if (interpolating) {
 			// Handle interpolating from current interpolation here
 			if (pAnimation != nextAnimation)
@@ -81,6 +357,7 @@ public:
 			// Else: Just playing current animation
 			// Start interpolation
 			if (pAnimation != nextAnimation) {
+				assert(pAnimation->getSkeleton() == currentAnimation->getSkeleton());
 				interpolating = true;
 				haltTime = fmod(currentTime, currentAnimation->getDuration());
 				nextAnimation = pAnimation;
@@ -90,86 +367,475 @@ public:
 		}
 	}
 
-	void calculateBoneTransition(const AssimpNodeData* curNode, glm::mat4 parentTransform, Animation* prevAnimation, Animation* nextAnimation, float haltTime, float currentTime, float transitionTime)
+	void setTransitionMode(TransitionMode mode)
+	{
+		transitionMode = mode;
+		interpolating = false;
+		inertializing = false;
+		nextAnimation = nullptr;
+		queueAnimation = nullptr;
+		interTime = 0.0f;
+	}
+
+	TransitionMode getTransitionMode() const { return transitionMode; }
+
+	// Switch to the new clip right away. The offset of the last sampled pose against the first
+	// frame of the new clip, and how fast it was changing, are kept and decayed over the
+	// transition duration.
+	void startInertialization(const Animation* pAnimation)
+	{
+		assert(pAnimation->getSkeleton() == currentAnimation->getSkeleton());
+		if (outputPoseCount > 0) {
+			samplePose(pAnimation, 0.0f, transitionTo, transitionContext);
+			applyLayers(0.0f, transitionTo);
+			inertializeTo(transitionTo);
+		}
+		currentAnimation = pAnimation;
+		currentTime = 0.0f;
+	}
+
+	// Let the offset of the last sampled pose against target decay from now on. Without
+	// recorded poses the offset starts at rest from the current local pose.
+	void inertializeTo(const Pose& target)
+	{
+		// transitionTo may have been overwritten, the crossfade has to sample its ends again
+		transitionSource = nullptr;
+		if (outputPoseCount > 0) {
+			const Pose& previous = outputPoseCount > 1 ? previousOutputPose : outputPose;
+			inertializePose(outputPose, previous, target, outputTime - previousOutputTime, TRANSITION_DURATION, inertialDecays);
+		}
+		else if (localPose.size() == target.size() && !culled) {
+			inertializePose(localPose, localPose, target, 0.0f, TRANSITION_DURATION, inertialDecays);
+		}
+		else {
+			return;
+		}
+		inertializing = true;
+		inertialTime = 0.0f;
+	}
+
+	// Play a blend space in place of a clip. Its pose is a mix of clips rather than one clip at
+	// one time, so moving into or out of it is always inertialized, whatever the transition mode.
+	void playBlendSpace(const BlendSpace* space)
+	{
+		if (space == blendSpace)
+			return;
+		interpolating = false;
+		nextAnimation = nullptr;
+		queueAnimation = nullptr;
+		interTime = 0.0f;
+
+		blendSpace = space;
+		blendPhase = 0.0f;
+		blendSampleTimes.assign(space->getSampleCount(), 0.0f);
+		space->evaluate(blendParameter, blendSpaceWeights);
+		sampleBlendSpace(0.0f, 0.0f, transitionTo);
+		applyLayers(0.0f, transitionTo);
+		inertializeTo(transitionTo);
+	}
+
+	// Position in the blend space, e.g. the velocity of the character
+	void setBlendParameter(const glm::vec2& parameter) { blendParameter = parameter; }
+
+	const glm::vec2& getBlendParameter() const { return blendParameter; }
+
+	const BlendSpace* getBlendSpace() const { return blendSpace; }
+
+	// Samples of the blend space are weighted anew every update. The synchronized ones share one
+	// normalized time, advancing at the weighted average of their lengths.
+	void updateBlendSpace(float dt)
+	{
+		clock += dt;
+		if (inertializing)
+			inertialTime += dt;
+
+		blendSpace->evaluate(blendParameter, blendSpaceWeights);
+		float phaseRate = getBlendPhaseRate();
+		blendPhase = fmod(blendPhase + phaseRate * dt, 1.0f);
+		for (int i = 0; i < blendSpace->getSampleCount(); i++) {
+			const Animation* animation = blendSpace->getSample(i).animation;
+			blendSampleTimes[i] = fmod(blendSampleTimes[i] + animation->getTicksPerSecond() * dt, animation->getDuration());
+		}
+
+		int lookahead;
+		bool sampled = beginPose(lookahead);
+		if (sampled) {
+			sampleBlendSpace(fmod(blendPhase + lookahead * phaseRate * dt, 1.0f), lookahead * dt, localPose);
+			poseFolded = false;
+			applyLayers(lookahead * dt, localPose);
+			if (inertializing)
+				applyInertialization(inertialDecays, inertialTime + lookahead * dt, localPose);
+			recordOutputPose(clock + lookahead * dt);
+		}
+		else if (culled) {
+			outputPoseCount = 0;
+		}
+		finishPose(blendSpace->getSample(0).animation, sampled);
+
+		if (inertializing && inertialTime >= TRANSITION_DURATION)
+			inertializing = false;
+	}
+
+	// Normalized time per second of the synchronized samples at the current weights
+	float getBlendPhaseRate() const
+	{
+		float weight = 0.0f;
+		float length = 0.0f;
+		for (int i = 0; i < blendSpaceWeights.count; i++) {
+			const BlendSample& sample = blendSpace->getSample(blendSpaceWeights.samples[i]);
+			if (sample.synchronized) {
+				weight += blendSpaceWeights.weights[i];
+				length += blendSpaceWeights.weights[i] * sample.animation->getDuration() / sample.animation->getTicksPerSecond();
+			}
+		}
+		return length > 0.0f ? weight / length : 0.0f;
+	}
+
+	// Blend the weighted samples of the blend space, at most three. ahead is the time in seconds
+	// the unsynchronized samples are sampled past their own time.
+	void sampleBlendSpace(float phase, float ahead, Pose& pose)
+	{
+		if (blendContexts.size() < (size_t)blendSpace->getSampleCount())
+			blendContexts.resize(blendSpace->getSampleCount());
+		blendPoseList.clear();
+		blendWeights.clear();
+
+		for (int i = 0; i < blendSpaceWeights.count; i++)
+		{
+			int index = blendSpaceWeights.samples[i];
+			const BlendSample& sample = blendSpace->getSample(index);
+			const Animation* animation = sample.animation;
+			float time = sample.synchronized ? phase * animation->getDuration()
+				: fmod(blendSampleTimes[index] + animation->getTicksPerSecond() * ahead, animation->getDuration());
+
+			// A single sample needs no blending
+			Pose& target = blendSpaceWeights.count == 1 ? pose : posePool.getPose(i);
+			samplePose(animation, time, target, blendContexts[index]);
+			blendPoseList.push_back(&target);
+			blendWeights.push_back(blendSpaceWeights.weights[i]);
+		}
+		if (blendPoseList.size() > 1)
+			blendPoses(blendPoseList.data(), blendWeights.data(), blendPoseList.size(), pose);
+	}
+
+	void recordOutputPose(float time)
 	{
-		std::string nodeName = curNode->name;
-		glm::mat4 transform = curNode->transformation;
+		std::swap(previousOutputPose, outputPose);
+		outputPose = localPose;
+		previousOutputTime = outputTime;
+		outputTime = time;
+		outputPoseCount = std::min(outputPoseCount + 1, 2);
+	}
 
-		Bone* prevBone = prevAnimation->findBone(nodeName);
-		Bone* nextBone = nextAnimation->findBone(nodeName);
+	// Sample any number of clips of one skeleton into pooled poses and blend them by weight in
+	// a single pass before building the palette. The caller drives the clip times, this does not
+	// go through the transitions of updateAnimation().
+	void blendAnimations(const BlendInput* inputs, size_t count)
+	{
+		if (blendContexts.size() < count)
+			blendContexts.resize(count);
+		blendPoseList.clear();
+		blendWeights.clear();
 
-		if (prevBone && nextBone)
+		const Animation* first = nullptr;
+		for (size_t i = 0; i < count; i++)
 		{
-			KeyPosition prevPos = prevBone->getPositions(haltTime);
-			KeyRotation prevRot = prevBone->getRotations(haltTime);
-			KeyScale prevScl = prevBone->getScalings(haltTime);
+			if (inputs[i].weight <= 0.0f)
+				continue;
+			assert(!first || inputs[i].animation->getSkeleton() == first->getSkeleton());
+			first = first ? first : inputs[i].animation;
+
+			Pose& pose = posePool.getPose(i);
+			pose = inputs[i].animation->getRestPose();
+			inputs[i].animation->sample(inputs[i].time, pose, blendContexts[i]);
+			blendPoseList.push_back(&pose);
+			blendWeights.push_back(inputs[i].weight);
+		}
+		if (!first)
+			return;
 
-			KeyPosition nextPos = nextBone->getPositions(0.0f);
-			KeyRotation nextRot = nextBone->getRotations(0.0f);
-			KeyScale nextScl = nextBone->getScalings(0.0f);
+		blendPoses(blendPoseList.data(), blendWeights.data(), blendPoseList.size(), localPose);
+		calculateFinalBoneMatrices(first);
+	}
 
-			prevPos.timeStamp = 0.0f;
-			prevRot.timeStamp = 0.0f;
-			prevScl.timeStamp = 0.0f;
+	// Play a clip on the nodes set in nodeMask over whatever the animator plays, see
+	// Skeleton::getSubtreeMask(). Returns the index of the layer, layers apply in order.
+	int addLayer(const Animation* animation, const std::vector<bool>& nodeMask, float weight = 1.0f)
+	{
+		layers.push_back(AnimationLayer());
+		AnimationLayer& layer = layers.back();
+		layer.nodeMask = nodeMask;
+		layer.weight = weight;
+		setLayerAnimation((int)layers.size() - 1, animation);
+		return (int)layers.size() - 1;
+	}
 
-			nextPos.timeStamp = transitionTime;
-			nextRot.timeStamp = transitionTime;
-			nextScl.timeStamp = transitionTime;
+	// Play another clip on the layer from its start, compiling the mask against its tracks
+	void setLayerAnimation(int index, const Animation* animation)
+	{
+		AnimationLayer& layer = layers[index];
+		assert((int)layer.nodeMask.size() == animation->getNodeCount());
+		layer.animation = animation;
+		layer.time = 0.0f;
+		layer.nodes.clear();
+		layer.tracks.clear();
+		for (int node = 0; node < animation->getNodeCount(); node++) {
+			if (layer.nodeMask[node] && animation->getNodeTrack(node) != -1) {
+				layer.nodes.push_back(node);
+				layer.tracks.push_back(animation->getNodeTrack(node));
+			}
+		}
+	}
+
+	// 0 leaves the nodes to the animation below, 1 replaces it
+	void setLayerWeight(int index, float weight) { layers[index].weight = weight; }
+
+	const AnimationLayer& getLayer(int index) const { return layers[index]; }
 
-			glm::mat4 p = interpolatePosition(currentTime, prevPos, nextPos);
-			glm::mat4 r = interpolateRotation(currentTime, prevRot, nextRot);
-			glm::mat4 s = interpolateScaling(currentTime, prevScl, nextScl);
+	int getLayerCount() const { return (int)layers.size(); }
 
-			transform = p * r * s;
+	void clearLayers() { layers.clear(); }
+
+	bool hasActiveLayers() const
+	{
+		for (auto& layer : layers) {
+			if (layer.weight > 0.0f && !layer.tracks.empty())
+				return true;
 		}
+		return false;
+	}
 
-		glm::mat4 globalTransformation = parentTransform * transform;
+	void advanceLayers(float dt)
+	{
+		for (auto& layer : layers)
+			layer.time = fmod(layer.time + layer.animation->getTicksPerSecond() * dt, layer.animation->getDuration());
+	}
 
-		auto boneProps = nextAnimation->getBoneProps();
-		for (unsigned int i = 0; i < boneProps.size(); i++) {
-			if (boneProps[i].name == nodeName) {
-				glm::mat4 offset = boneProps[i].offset;
-				finalBoneMatrices[i] = globalTransformation * offset;
-				break;
+	// Sample the tracks of every weighted layer, ahead seconds past its time, and blend them
+	// over the pose node by node
+	void applyLayers(float ahead, Pose& pose)
+	{
+		for (auto& layer : layers)
+		{
+			if (layer.weight <= 0.0f || layer.tracks.empty())
+				continue;
+			const Animation* animation = layer.animation;
+			layerPose.resize(animation->getNodeCount());
+			float time = fmod(layer.time + animation->getTicksPerSecond() * ahead, animation->getDuration());
+			animation->sample(time, layerPose, layer.context, layer.tracks);
+
+			float weight = glm::min(layer.weight, 1.0f);
+			for (int node : layer.nodes)
+			{
+				Transform& base = pose[node];
+				const Transform& over = layerPose[node];
+				if (weight >= 1.0f) {
+					base = over;
+					continue;
+				}
+				base.translation = glm::mix(base.translation, over.translation, weight);
+				base.scale = glm::mix(base.scale, over.scale, weight);
+				glm::quat rotation = glm::dot(base.rotation, over.rotation) < 0.0f ? -over.rotation : over.rotation;
+				base.rotation = glm::normalize(base.rotation * (1.0f - weight) + rotation * weight);
 			}
 		}
+	}
+
+	// Blend from the previous clip at haltTime to the first frame of the next clip.
+	// Neither end moves, so both are sampled once and then only blended.
+	void calculateBoneTransition(const Animation* prevAnimation, const Animation* nextAnimation, float haltTime, float currentTime, float transitionTime)
+	{
+		if (transitionSource != prevAnimation || transitionTarget != nextAnimation || transitionHaltTime != haltTime || transitionReduced != reducedSkeleton()) {
+			samplePose(prevAnimation, haltTime, transitionFrom, transitionContext);
+			samplePose(nextAnimation, 0.0f, transitionTo, transitionContext);
+			transitionSource = prevAnimation;
+			transitionTarget = nextAnimation;
+			transitionHaltTime = haltTime;
+			transitionReduced = reducedSkeleton();
+		}
+
+		float factor = glm::clamp(currentTime / transitionTime, 0.0f, 1.0f);
+		Pose* poses[] = { &transitionFrom, &transitionTo };
+		float weights[] = { 1.0f - factor, factor };
+		blendPoses(poses, weights, 2, localPose);
+	}
+
+	void calculateBoneTransform(const Animation* animation, float currentTime)
+	{
+		samplePose(animation, currentTime, localPose, context);
+	}
+
+	// Bind pose with the tracks of the clip applied, leaving out small bones on the reduced skeleton
+	void samplePose(const Animation* animation, float time, Pose& pose, AnimationContext& poseContext)
+	{
+		if (poseCache && !reducedSkeleton()) {
+			poseCache->samplePose(animation, time, pose, poseContext);
+			return;
+		}
+
+		pose = animation->getRestPose();
+		if (reducedSkeleton()) {
+			updateDetailTracks(animation);
+			animation->sample(time, pose, poseContext, detailTracks);
+			lodStats.skippedTracks += animation->getAnimatedTrackCount() - detailTracks.size();
+		}
+		else {
+			animation->sample(time, pose, poseContext);
+		}
+	}
 
-		for (int i = 0; i < curNode->childrenCount; i++)
-			calculateBoneTransition(&curNode->children[i], globalTransformation, prevAnimation, nextAnimation, haltTime, currentTime, transitionTime);
+	// Model space transform of the node in the pose the palette was last built from, on the
+	// lower levels of detail the blend of the last two sampled poses. Costs nothing, and is
+	// left as it was while culled. The identity for nodes outside the skeleton, and before
+	// the first update.
+	glm::mat4 getNodeTransform(int node) const
+	{
+		if (node < 0 || node >= (int)globalTransforms.size())
+			return glm::mat4(1.0f);
+		return globalTransforms[node];
 	}
 
-	void calculateBoneTransform(const AssimpNodeData* node, glm::mat4 parentTransform, Animation* animation, float currentTime)
+	// Model space transforms of count nodes of the current clip at time (in ticks), evaluating
+	// only their chains to the root, see Animation::getNodeTransforms(). The identity for every
+	// node while no clip is playing, and while a blend space plays as its samples have no common
+	// time to query at.
+	void queryNodeTransforms(const int* nodes, size_t count, float time, glm::mat4* transforms)
 	{
-		std::string nodeName = node->name;
-		glm::mat4 boneTransform = node->transformation;
+		if (!currentAnimation || blendSpace) {
+			std::fill(transforms, transforms + count, glm::mat4(1.0f));
+			return;
+		}
+		currentAnimation->getNodeTransforms(nodes, count, time, transforms, queryContext);
+	}
 
-		Bone* bone = animation->findBone(nodeName);
+	// Turn the local pose into matrices once per node, then resolve the hierarchy
+	// and apply the inverse bind matrices. When the local pose is the clip alone, the
+	// static nodes of the clip are taken from what it precomputed.
+	void calculateFinalBoneMatrices(const Animation* animation, bool folded = false)
+	{
+		const Skeleton* skeleton = animation->getSkeleton();
+		globalTransforms.resize(skeleton->getNodeCount());
+		glm::mat4* target = palette ? palette : finalBoneMatrices.data();
 
-		if (bone)
+		// Parents are stored before their children, so one forward pass resolves the hierarchy
+		for (int node = 0; node < skeleton->getNodeCount(); node++)
 		{
-			bone->update(currentTime);
-			boneTransform = bone->getTransform();
+			NodeMotion motion = folded ? animation->getNodeMotion(node) : NODE_ANIMATED;
+			int boneIndex = animation->getNodePaletteIndex(node);
+			if (motion == NODE_STATIC_CHAIN) {
+				globalTransforms[node] = animation->getRestGlobalTransform(node);
+				if (boneIndex != -1)
+					target[boneIndex] = animation->getRestBoneMatrix(node);
+				continue;
+			}
+
+			glm::mat4 local = motion == NODE_STATIC ? animation->getRestLocalTransform(node) : composeTransform(localPose[node]);
+
+			int parent = skeleton->parents[node];
+			globalTransforms[node] = parent == -1 ? local : multiplyAffine(globalTransforms[parent], local);
+
+			if (boneIndex != -1)
+				target[boneIndex] = multiplyAffine(globalTransforms[node], animation->getBoneProps()[boneIndex].offset);
 		}
+	}
 
-		glm::mat4 globalTransformation = parentTransform * boneTransform;
+	// Whether this update samples a new pose, and how many updates ahead of the current time.
+	// Sampling ahead lets the interpolated poses follow the current time instead of lagging behind.
+	bool beginPose(int& lookahead)
+	{
+		lookahead = 0;
+		if (culled) {
+			lodStats.culledUpdates++;
+			return false;
+		}
+		lodStats.sampledUpdates++;
+		if (lod == LOD_FULL)
+			return true;
+
+		int interval = 1 << lod;
+		if (!lodPosesValid) {
+			// Start from the current pose, the next update samples ahead
+			lodFrame = interval - 1;
+			return true;
+		}
+		if (++lodFrame >= interval) {
+			lodFrame = 0;
+			lookahead = interval - 1;
+			return true;
+		}
+		lodStats.sampledUpdates--;
+		lodStats.interpolatedUpdates++;
+		return false;
+	}
 
-		auto boneProps = animation->getBoneProps();
+	// Build the palette. The lower levels keep the last two sampled local poses and rebuild
+	// the palette from their blend, reaching the latest one at the update it was sampled for.
+	// Blending local transforms rather than palette matrices keeps twisting bones from
+	// collapsing, as the rotations are interpolated as rotations.
+	void finishPose(const Animation* animation, bool sampled)
+	{
+		if (culled) {
+			lodPosesValid = false;
+			return;
+		}
+		if (lod == LOD_FULL) {
+			lodPosesValid = false;
+			calculateFinalBoneMatrices(animation, poseFolded);
+			return;
+		}
 
-		for (unsigned int i = 0; i < boneProps.size(); i++) {
-			if (boneProps[i].name == nodeName) {
-				glm::mat4 offset = boneProps[i].offset;
-				finalBoneMatrices[i] = globalTransformation * offset;
-				break;
+		if (sampled) {
+			std::swap(previousLodPose, latestLodPose);
+			latestLodPose = localPose;
+			latestLodFolded = poseFolded;
+			if (!lodPosesValid || previousLodPose.size() != latestLodPose.size()) {
+				previousLodPose = latestLodPose;
+				previousLodFolded = latestLodFolded;
 			}
+			lodPosesValid = true;
 		}
 
-		for (int i = 0; i < node->childrenCount; i++)
-			calculateBoneTransform(&node->children[i], globalTransformation, animation, currentTime);
+		float factor = (lodFrame + 1) / (float)(1 << lod);
+		if (factor >= 1.0f) {
+			localPose = latestLodPose;
+		}
+		else {
+			Pose* poses[2] = { &previousLodPose, &latestLodPose };
+			float weights[2] = { 1.0f - factor, factor };
+			blendPoses(poses, weights, 2, localPose);
+		}
+		// Static nodes hold their rest transforms in every sampled pose, so the blend may still
+		// take them precomputed when both poses could
+		calculateFinalBoneMatrices(animation, previousLodFolded && latestLodFolded);
+	}
+
+	bool reducedSkeleton() const { return lod != LOD_FULL && lod >= lodSettings.reducedSkeletonLod; }
+
+	void updateDetailNodes(const Skeleton* skeleton)
+	{
+		if (detailSkeleton == skeleton)
+			return;
+		std::vector<float> reach = skeleton->getNodeReach();
+		detailNodes.resize(reach.size());
+		for (size_t node = 0; node < reach.size(); node++)
+			detailNodes[node] = reach[node] >= lodSettings.minBoneReach;
+		detailSkeleton = skeleton;
+		detailAnimation = nullptr;
+	}
+
+	void updateDetailTracks(const Animation* animation)
+	{
+		updateDetailNodes(animation->getSkeleton());
+		if (detailAnimation == animation)
+			return;
+		animation->getNodeTracks(detailNodes, detailTracks);
+		detailAnimation = animation;
 	}
 
+	// Copy of the palette, allocates, per frame use getPalette()
 	std::vector<glm::mat4> getFinalBoneMatrices()
 	{
-		return finalBoneMatrices;
+		return std::vector<glm::mat4>(getPalette(), getPalette() + MAX_BONES);
 	}
 };
 
@@ -0,0 +1,77 @@
+#ifndef BLEND_HPP
+#define BLEND_HPP
+
+#include <glm/glm.hpp>
+#include <glm/gtx/quaternion.hpp>
+
+#include <deque>
+
+#include "pose.hpp"
+#include "simd.hpp"
+
+// Local pose buffers reused from one update to the next. Buffers keep their memory,
+// so once every slot has been used at full size no update allocates.
+class PosePool
+{
+public:
+	// Buffer of the given slot, created on first use. References stay valid as the pool grows.
+	Pose& getPose(size_t slot)
+	{
+		while (poses.size() <= slot)
+			poses.push_back(Pose());
+		return poses[slot];
+	}
+
+	size_t getSize() const { return poses.size(); }
+
+private:
+	std::deque<Pose> poses;
+};
+
+// Weighted average of count poses of the same skeleton. The rotations of every pose are
+// first moved into the hemisphere of the first pose, which may negate them in place. The
+// poses are then summed as flat float arrays, SIMD_LANES floats at a time, and the
+// rotations normalized. Weights are normalized to sum to one.
+void blendPoses(Pose* const* poses, const float* weights, size_t count, Pose& result)
+{
+	static_assert(sizeof(Transform) == 10 * sizeof(float), "Transform is blended as 10 packed floats");
+
+	size_t nodeCount = poses[0]->size();
+	result.resize(nodeCount);
+
+	float totalWeight = 0.0f;
+	for (size_t i = 0; i < count; i++)
+		totalWeight += weights[i];
+
+	for (size_t i = 1; i < count; i++) {
+		Pose& pose = *poses[i];
+		for (size_t node = 0; node < nodeCount; node++) {
+			if (glm::dot((*poses[0])[node].rotation, pose[node].rotation) < 0.0f)
+				pose[node].rotation = -pose[node].rotation;
+		}
+	}
+
+	size_t floatCount = nodeCount * 10;
+	float* target = reinterpret_cast<float*>(result.data());
+	for (size_t i = 0; i < count; i++)
+	{
+		const float* source = reinterpret_cast<const float*>(poses[i]->data());
+		float weight = weights[i] / totalWeight;
+		FloatLanes weightLanes = lanesSet(weight);
+
+		size_t index = 0;
+		for (; index + SIMD_LANES <= floatCount; index += SIMD_LANES) {
+			FloatLanes value = lanesMul(lanesLoadUnaligned(source + index), weightLanes);
+			if (i > 0)
+				value = lanesAdd(value, lanesLoadUnaligned(target + index));
+			lanesStoreUnaligned(target + index, value);
+		}
+		for (; index < floatCount; index++)
+			target[index] = (i > 0 ? target[index] : 0.0f) + source[index] * weight;
+	}
+
+	for (size_t node = 0; node < nodeCount; node++)
+		result[node].rotation = glm::normalize(result[node].rotation);
+}
+
+#endif
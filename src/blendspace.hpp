@@ -0,0 +1,186 @@
+#ifndef BLENDSPACE_HPP
+#define BLENDSPACE_HPP
+
+#include <glm/glm.hpp>
+
+#include <cfloat>
+#include <vector>
+
+#include "animation.hpp"
+
+// One clip of a blend space, placed at the parameter (e.g. velocity) it was made for.
+// Synchronized clips are cycles played at one shared normalized time, so their feet stay in
+// step. Others, such as an idle of a different length, keep their own time.
+struct BlendSample
+{
+	const Animation* animation;
+	glm::vec2 position;
+	bool synchronized;
+};
+
+// Up to three samples and their weights at one parameter
+struct BlendWeights
+{
+	int count;
+	int samples[3];
+	float weights[3];
+};
+
+// Clips placed on a 2D parameter space and triangulated once. At any parameter at most the
+// three clips of the enclosing triangle are weighted, outside the triangulation the closest
+// point on its border is used.
+class BlendSpace
+{
+public:
+	int addSample(const Animation* animation, const glm::vec2& position, bool synchronized = true)
+	{
+		assert(samples.empty() || animation->getSkeleton() == samples[0].animation->getSkeleton());
+		samples.push_back({ animation, position, synchronized });
+		triangles.clear();
+		return (int)samples.size() - 1;
+	}
+
+	// Use the given triangles, three sample indices each, instead of triangulate()
+	void setTriangles(const std::vector<int>& indices)
+	{
+		triangles = indices;
+	}
+
+	// Delaunay triangulation of the samples. Every triple whose circumcircle holds no other
+	// sample is a triangle, which is plenty fast for the handful of clips of a blend space.
+	void triangulate()
+	{
+		triangles.clear();
+		int count = (int)samples.size();
+		for (int a = 0; a < count; a++)
+			for (int b = a + 1; b < count; b++)
+				for (int c = b + 1; c < count; c++)
+				{
+					glm::vec2 pa = samples[a].position, pb = samples[b].position, pc = samples[c].position;
+					float area = cross(pb - pa, pc - pa);
+					if (glm::abs(area) < 1e-6f)
+						continue;
+
+					bool empty = true;
+					for (int d = 0; d < count && empty; d++)
+						if (d != a && d != b && d != c && inCircumcircle(pa, pb, pc, samples[d].position))
+							empty = false;
+					// Samples on a common circle allow two triangulations, keep the first
+					glm::vec2 centroid = (pa + pb + pc) / 3.0f;
+					for (size_t t = 0; t < triangles.size() && empty; t += 3)
+						if (inTriangle(&triangles[t], centroid))
+							empty = false;
+
+					if (empty) {
+						triangles.push_back(a);
+						triangles.push_back(b);
+						triangles.push_back(c);
+					}
+				}
+		std::cout << "Blend space: " << samples.size() << " samples, " << triangles.size() / 3 << " triangles" << std::endl;
+	}
+
+	void evaluate(const glm::vec2& parameter, BlendWeights& result) const
+	{
+		result.count = 0;
+		if (samples.empty())
+			return;
+
+		for (size_t t = 0; t < triangles.size(); t += 3)
+		{
+			glm::vec3 barycentric = getBarycentric(&triangles[t], parameter);
+			if (barycentric.x >= -1e-5f && barycentric.y >= -1e-5f && barycentric.z >= -1e-5f) {
+				barycentric = glm::max(barycentric, glm::vec3(0.0f));
+				barycentric /= barycentric.x + barycentric.y + barycentric.z;
+				for (int i = 0; i < 3; i++)
+					add(result, triangles[t + i], barycentric[i]);
+				return;
+			}
+		}
+
+		// Outside, blend the two ends of the closest edge
+		float closestDistance = FLT_MAX;
+		int closestA = 0, closestB = 0;
+		float closestFactor = 0.0f;
+		for (size_t t = 0; t < triangles.size(); t += 3)
+			for (int i = 0; i < 3; i++)
+			{
+				int a = triangles[t + i], b = triangles[t + (i + 1) % 3];
+				glm::vec2 edge = samples[b].position - samples[a].position;
+				float factor = glm::clamp(glm::dot(parameter - samples[a].position, edge) / glm::dot(edge, edge), 0.0f, 1.0f);
+				float distance = glm::length(samples[a].position + edge * factor - parameter);
+				if (distance < closestDistance) {
+					closestDistance = distance;
+					closestA = a;
+					closestB = b;
+					closestFactor = factor;
+				}
+			}
+		if (triangles.empty()) {
+			// Not triangulated, use the nearest sample
+			for (int i = 0; i < (int)samples.size(); i++) {
+				float distance = glm::length(samples[i].position - parameter);
+				if (distance < closestDistance) {
+					closestDistance = distance;
+					closestA = closestB = i;
+				}
+			}
+		}
+		add(result, closestA, 1.0f - closestFactor);
+		add(result, closestB, closestFactor);
+	}
+
+	const BlendSample& getSample(int index) const { return samples[index]; }
+
+	int getSampleCount() const { return (int)samples.size(); }
+
+	const std::vector<int>& getTriangles() const { return triangles; }
+
+private:
+	std::vector<BlendSample> samples;
+	std::vector<int> triangles;
+
+	static float cross(const glm::vec2& a, const glm::vec2& b) { return a.x * b.y - a.y * b.x; }
+
+	static bool inCircumcircle(glm::vec2 a, glm::vec2 b, glm::vec2 c, const glm::vec2& p)
+	{
+		if (cross(b - a, c - a) < 0.0f)
+			std::swap(b, c);
+		a -= p;
+		b -= p;
+		c -= p;
+		float determinant = glm::dot(a, a) * cross(b, c) - glm::dot(b, b) * cross(a, c) + glm::dot(c, c) * cross(a, b);
+		return determinant > 1e-6f;
+	}
+
+	glm::vec3 getBarycentric(const int* triangle, const glm::vec2& p) const
+	{
+		glm::vec2 a = samples[triangle[0]].position, b = samples[triangle[1]].position, c = samples[triangle[2]].position;
+		float area = cross(b - a, c - a);
+		float u = cross(b - p, c - p) / area;
+		float v = cross(c - p, a - p) / area;
+		return glm::vec3(u, v, 1.0f - u - v);
+	}
+
+	bool inTriangle(const int* triangle, const glm::vec2& p) const
+	{
+		glm::vec3 barycentric = getBarycentric(triangle, p);
+		return barycentric.x >= -1e-5f && barycentric.y >= -1e-5f && barycentric.z >= -1e-5f;
+	}
+
+	static void add(BlendWeights& result, int sample, float weight)
+	{
+		if (weight <= 0.0f)
+			return;
+		for (int i = 0; i < result.count; i++)
+			if (result.samples[i] == sample) {
+				result.weights[i] += weight;
+				return;
+			}
+		result.samples[result.count] = sample;
+		result.weights[result.count] = weight;
+		result.count++;
+	}
+};
+
+#endif
@@ -10,132 +10,287 @@
 #include <vector>
 
 #include "interpolation.hpp"
+#include "compression.hpp"
+#include "pose.hpp"
+
+// Optional processing applied to a clip while it is loaded
+struct ImportSettings
+{
+	// Resample every track at this many keys per second, 0 keeps the original keys
+	float sampleRate = 0.0f;
+	// Quantize the keys and collapse constant channels to a single key
+	bool compress = false;
+	// Size of a compressed rotation key, 48 or 32 bits
+	int rotationBits = 48;
+	// Drop keys while keeping every joint within this object space distance of the original
+	// motion, 0 keeps every key. Skipped when resampling.
+	float reductionTolerance = 0.0f;
+	// How rotations are interpolated between keys, fixed for the lifetime of the clip
+	RotationInterpolation rotationInterpolation = NLERP;
+};
+
+// Where a playback last found the keys of one track, so forward playback only has to check the next key.
+// Kept by whoever plays the clip, a Bone itself is never modified once loaded.
+struct TrackCursor
+{
+	size_t position = 0;
+	size_t rotation = 0;
+	size_t scale = 0;
+};
 
 class Bone
 {
 private:
-	glm::mat4 transform;
-	std::vector<KeyPosition> positions;
-	std::vector<KeyRotation> rotations;
-	std::vector<KeyScale> scales;
+	KeyChannel<glm::vec3> positions;
+	KeyChannel<glm::quat> rotations;
+	KeyChannel<glm::vec3> scales;
+	// Replace the float channels above when the clip is compressed
+	QuantizedVec3Channel compressedPositions;
+	QuantizedQuatChannel compressedRotations;
+	QuantizedVec3Channel compressedScales;
+	bool compressed;
 	size_t numPositions;
 	size_t numRotations;
 	size_t numScalings;
+	TrackError resampleError;
+	TrackError reductionError;
+	size_t removedKeys;
+	TrackError compressionError;
+	size_t uncompressedMemory;
+	float nlerpError;
+	float scaleDeviation;
 	std::string name;
 	unsigned int id;
 
 public:
-	Bone(const std::string& inName, int inId, const aiNodeAnim* channel) {
+	// jointTolerance is the share of the reduction tolerance given to this joint, and reach the
+	// object space distance from the joint to the end of its chain, see Skeleton::getNodeReach()
+	Bone(const std::string& inName, int inId, const aiNodeAnim* channel, float duration = 0.0f, float ticksPerSecond = 1.0f,
+		const ImportSettings& settings = ImportSettings(), float jointTolerance = 0.0f, float reach = 0.0f) {
 		name = inName;
 		id = inId;
-		transform = glm::mat4(1.0f);
+		compressed = false;
+		removedKeys = 0;
 
 		numPositions = channel->mNumPositionKeys;
-
+		positions.times.reserve(numPositions);
+		positions.values.reserve(numPositions);
 		for (int positionIndex = 0; positionIndex < numPositions; ++positionIndex)
 		{
 			aiVector3D aiPosition = channel->mPositionKeys[positionIndex].mValue;
-			float timeStamp = (float)channel->mPositionKeys[positionIndex].mTime;
-			KeyPosition data = { glm::vec3(aiPosition.x, aiPosition.y, aiPosition.z), timeStamp };
-			positions.push_back(data);
+			positions.times.push_back((float)channel->mPositionKeys[positionIndex].mTime);
+			positions.values.push_back(glm::vec3(aiPosition.x, aiPosition.y, aiPosition.z));
 		}
 
 		numRotations = channel->mNumRotationKeys;
+		rotations.times.reserve(numRotations);
+		rotations.values.reserve(numRotations);
 		for (int rotationIndex = 0; rotationIndex < numRotations; ++rotationIndex)
 		{
 			aiQuaternion aiOrientation = channel->mRotationKeys[rotationIndex].mValue;
-			float timeStamp = (float)channel->mRotationKeys[rotationIndex].mTime;
-			KeyRotation data = { glm::quat(aiOrientation.w, aiOrientation.x, aiOrientation.y, aiOrientation.z), timeStamp };
-			rotations.push_back(data);
+			rotations.times.push_back((float)channel->mRotationKeys[rotationIndex].mTime);
+			glm::quat orientation(aiOrientation.w, aiOrientation.x, aiOrientation.y, aiOrientation.z);
+			// Keep consecutive keys in the same hemisphere, so nlerp can skip the shortest arc check
+			if (rotationIndex > 0 && glm::dot(rotations.values.back(), orientation) < 0.0f)
+				orientation = -orientation;
+			rotations.values.push_back(orientation);
 		}
 
 		numScalings = channel->mNumScalingKeys;
+		scales.times.reserve(numScalings);
+		scales.values.reserve(numScalings);
 		for (int keyIndex = 0; keyIndex < numScalings; ++keyIndex)
 		{
 			aiVector3D scale = channel->mScalingKeys[keyIndex].mValue;
-			float timeStamp = (float)channel->mScalingKeys[keyIndex].mTime;
-			KeyScale data = { glm::vec3(scale.x, scale.y, scale.z), timeStamp };
-			scales.push_back(data);
+			scales.times.push_back((float)channel->mScalingKeys[keyIndex].mTime);
+			scales.values.push_back(glm::vec3(scale.x, scale.y, scale.z));
 		}
-	}
 
-	KeyPosition getPositions(float animationTime) {
-		size_t posIndex = (animationTime == 0.0f) ? 0 : getPositionIndex(animationTime) + 1;
-		return positions[posIndex];
-	}
+		scaleDeviation = measureScaleDeviation();
 
-	KeyRotation getRotations(float animationTime) {
-		size_t rotIndex = (animationTime == 0.0f) ? 0 : getRotationIndex(animationTime) + 1;
-		return rotations[rotIndex];
-	}
+		if (settings.sampleRate <= 0.0f && jointTolerance > 0.0f)
+			reduce(jointTolerance, reach);
 
-	KeyScale getScalings(float animationTime) {
-		size_t sclIndex = (animationTime == 0.0f) ? 0 : getScaleIndex(animationTime) + 1;
-		return scales[sclIndex];
-	}
+		if (settings.sampleRate > 0.0f)
+			resample(duration, ticksPerSecond > 0.0f ? settings.sampleRate / ticksPerSecond : settings.sampleRate);
+
+		nlerpError = measureNlerpError();
+		uncompressedMemory = getMemoryUsage();
 
+		if (settings.compress)
+			compress(settings.rotationBits);
+	}
 
-	void update(float animationTime)
+	// Key pairs surrounding animationTime and the factor to interpolate them with
+	void getPositionKeys(float animationTime, size_t& cursor, glm::vec3& from, glm::vec3& to, float& factor) const
 	{
-		size_t posIndex = getPositionIndex(animationTime);
-		glm::mat4 translation;
-		if (numPositions == 1) {
-			translation = glm::translate(glm::mat4(1.0f), positions[0].position);
-		}
+		if (compressed)
+			findKeys(compressedPositions, animationTime, cursor, from, to, factor);
 		else
-			translation = interpolatePosition(animationTime, positions[posIndex], positions[posIndex + 1]);
+			findKeys(positions, animationTime, cursor, from, to, factor);
+	}
 
-		size_t rotIndex = getRotationIndex(animationTime);
-		glm::mat4 rotation;
-		if (numRotations == 1)
-			rotation = glm::toMat4(glm::normalize(rotations[0].orientation));
+	void getRotationKeys(float animationTime, size_t& cursor, glm::quat& from, glm::quat& to, float& factor) const
+	{
+		if (compressed)
+			findKeys(compressedRotations, animationTime, cursor, from, to, factor);
 		else
-			rotation = interpolateRotation(animationTime, rotations[rotIndex], rotations[rotIndex + 1]);
+			findKeys(rotations, animationTime, cursor, from, to, factor);
+	}
 
-		size_t sclIndex = getScaleIndex(animationTime);
-		glm::mat4 scale;
-		if (numScalings == 1)
-			scale = glm::scale(glm::mat4(1.0f), scales[0].scale);
+	void getScaleKeys(float animationTime, size_t& cursor, glm::vec3& from, glm::vec3& to, float& factor) const
+	{
+		if (compressed)
+			findKeys(compressedScales, animationTime, cursor, from, to, factor);
 		else
-			scale = interpolateScaling(animationTime, scales[sclIndex], scales[sclIndex + 1]);
-		transform = translation * rotation * scale;
+			findKeys(scales, animationTime, cursor, from, to, factor);
 	}
 
-	glm::mat4 getTransform() { return transform; }
-	std::string getBoneName() const { return name; }
-	unsigned int getId() const { return id; }
-
-	size_t getPositionIndex(float animationTime)
+	// Replace the keys by evenly spaced ones and drop the timestamps
+	void resample(float duration, float keysPerTick)
 	{
-		for (size_t index = 0; index < numPositions - 1; ++index)
+		KeyChannel<glm::vec3> uniformPositions = resampleChannel(positions, duration, keysPerTick);
+		KeyChannel<glm::quat> uniformRotations = resampleChannel(rotations, duration, keysPerTick);
+		KeyChannel<glm::vec3> uniformScales = resampleChannel(scales, duration, keysPerTick);
+
+		resampleError.position = measureChannelError(positions, uniformPositions);
+		resampleError.rotation = measureChannelError(rotations, uniformRotations);
+		resampleError.scale = measureChannelError(scales, uniformScales);
+
+		std::swap(positions, uniformPositions);
+		std::swap(rotations, uniformRotations);
+		std::swap(scales, uniformScales);
+		numPositions = positions.values.size();
+		numRotations = rotations.values.size();
+		numScalings = scales.values.size();
+
+		// Slerp keeps the resampled keys on the shortest arc, keep them in one hemisphere for nlerp too
+		for (size_t index = 1; index < numRotations; ++index)
 		{
-			if (animationTime < positions[index + 1].timeStamp)
-				return index;
+			if (glm::dot(rotations.values[index - 1], rotations.values[index]) < 0.0f)
+				rotations.values[index] = -rotations.values[index];
 		}
-		return numPositions - 2;
 	}
 
-	size_t getRotationIndex(float animationTime)
+	const TrackError& getResampleError() const { return resampleError; }
+
+	// Drop redundant keys, moving the joint's chain by at most tolerance. The tolerance is split
+	// over the three channels: a translation error moves the chain by the same distance, while
+	// rotation and scale errors grow with the reach of the chain.
+	void reduce(float tolerance, float reach)
+	{
+		KeyChannel<glm::vec3> originalPositions = positions;
+		KeyChannel<glm::quat> originalRotations = rotations;
+		KeyChannel<glm::vec3> originalScales = scales;
+
+		tolerance /= 3.0f;
+		float chainTolerance = reach > 0.0f ? tolerance / reach : 0.0f;
+		removedKeys += reduceChannel(positions, tolerance);
+		removedKeys += reduceChannel(rotations, chainTolerance);
+		removedKeys += reduceChannel(scales, chainTolerance);
+
+		reductionError.position = measureChannelError(originalPositions, positions);
+		reductionError.rotation = measureChannelError(originalRotations, rotations);
+		reductionError.scale = measureChannelError(originalScales, scales);
+
+		numPositions = positions.size();
+		numRotations = rotations.size();
+		numScalings = scales.size();
+	}
+
+	const TrackError& getReductionError() const { return reductionError; }
+
+	size_t getRemovedKeyCount() const { return removedKeys; }
+
+	size_t getKeyCount() const { return numPositions + numRotations + numScalings; }
+
+	// Collapse constant channels and quantize the keys. The float channels are released,
+	// load the clip without compression to keep them as a reference.
+	void compress(int rotationBits)
+	{
+		KeyChannel<glm::vec3> collapsedPositions = positions;
+		KeyChannel<glm::quat> collapsedRotations = rotations;
+		KeyChannel<glm::vec3> collapsedScales = scales;
+		collapseConstantChannel(collapsedPositions, 1e-5f);
+		collapseConstantChannel(collapsedRotations, 1e-5f);
+		collapseConstantChannel(collapsedScales, 1e-5f);
+
+		compressedPositions = quantizeChannel(collapsedPositions);
+		compressedRotations = quantizeChannel(collapsedRotations, rotationBits);
+		compressedScales = quantizeChannel(collapsedScales);
+
+		compressionError.position = measureChannelError(positions, compressedPositions);
+		compressionError.rotation = measureChannelError(rotations, compressedRotations);
+		compressionError.scale = measureChannelError(scales, compressedScales);
+
+		positions = KeyChannel<glm::vec3>();
+		rotations = KeyChannel<glm::quat>();
+		scales = KeyChannel<glm::vec3>();
+		numPositions = compressedPositions.size();
+		numRotations = compressedRotations.size();
+		numScalings = compressedScales.size();
+		compressed = true;
+	}
+
+	const TrackError& getCompressionError() const { return compressionError; }
+
+	// Whether the track holds one transform for the whole clip, so it only needs sampling once
+	bool isConstant() const
+	{
+		if (compressed)
+			return compressedPositions.size() == 1 && compressedRotations.size() == 1 && compressedScales.size() == 1;
+		return isChannelConstant(positions) && isChannelConstant(rotations) && isChannelConstant(scales);
+	}
+
+	// Bytes used by the keys
+	size_t getMemoryUsage() const
 	{
-		for (size_t index = 0; index < numRotations - 1; ++index)
+		if (compressed)
+			return getChannelMemory(compressedPositions) + getChannelMemory(compressedRotations) + getChannelMemory(compressedScales);
+		return getChannelMemory(positions) + getChannelMemory(rotations) + getChannelMemory(scales);
+	}
+
+	size_t getUncompressedMemoryUsage() const { return uncompressedMemory; }
+
+	// Largest angle in radians between nlerp and slerp, measured on the float keys at load
+	float getNlerpError() const { return nlerpError; }
+
+	// Largest angle in radians between nlerp and slerp over all rotation key pairs
+	float measureNlerpError() const
+	{
+		float maxError = 0.0f;
+		for (size_t index = 0; index + 1 < numRotations; ++index)
 		{
-			if (animationTime < rotations[index + 1].timeStamp)
-				return index;
+			const glm::quat& from = rotations.values[index];
+			const glm::quat& to = rotations.values[index + 1];
+			for (int step = 1; step < 4; ++step)
+			{
+				float factor = step * 0.25f;
+				glm::quat exact = glm::normalize(glm::slerp(from, to, factor));
+				glm::quat approximate = glm::normalize(from + (to - from) * factor);
+				maxError = glm::max(maxError, keyDistance(exact, approximate));
+			}
 		}
-		return numRotations - 2;
+		return maxError;
 	}
 
-	size_t getScaleIndex(float animationTime)
+	// Largest difference of a scale key component from one, measured on the keys as loaded
+	float getScaleDeviation() const { return scaleDeviation; }
+
+	float measureScaleDeviation() const
 	{
-		for (size_t index = 0; index < numScalings - 1; ++index)
-		{
-			if (animationTime < scales[index + 1].timeStamp)
-				return index;
+		float maxDeviation = 0.0f;
+		for (const glm::vec3& scale : scales.values) {
+			glm::vec3 deviation = glm::abs(scale - glm::vec3(1.0f));
+			maxDeviation = glm::max(maxDeviation, glm::max(deviation.x, glm::max(deviation.y, deviation.z)));
 		}
-		return numScalings - 2;
+		return maxDeviation;
 	}
+
+	const std::string& getBoneName() const { return name; }
+	unsigned int getId() const { return id; }
 };
 
 
 
-#endif
\ No newline at end of file
+#endif
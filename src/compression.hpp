@@ -0,0 +1,174 @@
+#ifndef COMPRESSION_HPP
+#define COMPRESSION_HPP
+
+#include <glm/glm.hpp>
+#include <glm/gtx/quaternion.hpp>
+
+#include <cstdint>
+#include <vector>
+
+#include "interpolation.hpp"
+
+// Largest value of the three smallest quaternion components
+const float SMALLEST_THREE_RANGE = 0.70710678f;
+
+// Positions or scales quantized to 16 bits per component within the range of the channel
+struct QuantizedVec3Channel
+{
+	std::vector<float> times;
+	std::vector<uint16_t> values;
+	glm::vec3 minimum = glm::vec3(0.0f);
+	glm::vec3 step = glm::vec3(0.0f);
+	float rate = 0.0f;
+
+	size_t size() const { return values.size() / 3; }
+};
+
+// Rotations in smallest-three form. The index of the largest component takes 2 bits and the
+// other three components 15 bits each for 48-bit keys, or 10 bits each for 32-bit keys.
+struct QuantizedQuatChannel
+{
+	std::vector<float> times;
+	std::vector<uint16_t> values;
+	int wordsPerKey = 3;
+	int componentBits = 15;
+	float rate = 0.0f;
+
+	// Constant divisors, this is called on every key lookup
+	size_t size() const { return wordsPerKey == 3 ? values.size() / 3 : values.size() / 2; }
+};
+
+glm::vec3 decodeKey(const QuantizedVec3Channel& channel, size_t index)
+{
+	const uint16_t* key = &channel.values[index * 3];
+	return channel.minimum + glm::vec3(key[0], key[1], key[2]) * channel.step;
+}
+
+glm::quat decodeKey(const QuantizedQuatChannel& channel, size_t index)
+{
+	const uint16_t* key = &channel.values[index * channel.wordsPerKey];
+	uint64_t packed = key[0] | (uint64_t)key[1] << 16;
+	if (channel.wordsPerKey == 3)
+		packed |= (uint64_t)key[2] << 32;
+
+	// Components fit 32 bits, converting those to float is a single instruction unlike 64 bits
+	int bits = channel.componentBits;
+	uint32_t mask = (1u << bits) - 1;
+	float step = 2.0f * SMALLEST_THREE_RANGE / (float)mask;
+	float a = (int32_t)((uint32_t)(packed >> 2) & mask) * step - SMALLEST_THREE_RANGE;
+	float b = (int32_t)((uint32_t)(packed >> (2 + bits)) & mask) * step - SMALLEST_THREE_RANGE;
+	float c = (int32_t)((uint32_t)(packed >> (2 + 2 * bits)) & mask) * step - SMALLEST_THREE_RANGE;
+
+	// The three smallest fill the other components in order, selected rather than stored
+	// through an index so the result stays in registers
+	int largest = packed & 3;
+	float d = glm::sqrt(glm::max(1.0f - a * a - b * b - c * c, 0.0f));
+	float x = largest == 0 ? d : a;
+	float y = largest == 1 ? d : (largest == 0 ? a : b);
+	float z = largest == 2 ? d : (largest == 3 ? c : b);
+	float w = largest == 3 ? d : c;
+	return glm::quat(w, x, y, z);
+}
+
+// Smallest-three always decodes with a positive largest component, which can put
+// neighbouring keys in opposite hemispheres
+void alignKeys(const QuantizedQuatChannel&, const glm::quat& from, glm::quat& to)
+{
+	if (glm::dot(from, to) < 0.0f)
+		to = -to;
+}
+
+QuantizedVec3Channel quantizeChannel(const KeyChannel<glm::vec3>& channel)
+{
+	QuantizedVec3Channel result;
+	result.times = channel.times;
+	result.rate = channel.rate;
+
+	glm::vec3 minimum = channel.values[0];
+	glm::vec3 maximum = channel.values[0];
+	for (size_t index = 1; index < channel.size(); ++index)
+	{
+		minimum = glm::min(minimum, channel.values[index]);
+		maximum = glm::max(maximum, channel.values[index]);
+	}
+	result.minimum = minimum;
+	result.step = (maximum - minimum) / 65535.0f;
+
+	result.values.reserve(channel.size() * 3);
+	for (size_t index = 0; index < channel.size(); ++index)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			float quantized = result.step[c] > 0.0f ? (channel.values[index][c] - minimum[c]) / result.step[c] : 0.0f;
+			result.values.push_back((uint16_t)glm::clamp(glm::round(quantized), 0.0f, 65535.0f));
+		}
+	}
+	return result;
+}
+
+// bits is either 48 or 32
+QuantizedQuatChannel quantizeChannel(const KeyChannel<glm::quat>& channel, int bits)
+{
+	QuantizedQuatChannel result;
+	result.times = channel.times;
+	result.rate = channel.rate;
+	result.wordsPerKey = bits / 16;
+	result.componentBits = (bits - 2) / 3;
+
+	uint64_t mask = (1u << result.componentBits) - 1;
+	float scale = mask / (2.0f * SMALLEST_THREE_RANGE);
+	result.values.reserve(channel.size() * result.wordsPerKey);
+	for (size_t index = 0; index < channel.size(); ++index)
+	{
+		const glm::quat& q = channel.values[index];
+		float components[4] = { q.x, q.y, q.z, q.w };
+		int largest = 0;
+		for (int c = 1; c < 4; c++)
+		{
+			if (glm::abs(components[c]) > glm::abs(components[largest]))
+				largest = c;
+		}
+		float sign = components[largest] < 0.0f ? -1.0f : 1.0f;
+
+		uint64_t packed = largest;
+		int shift = 2;
+		for (int c = 0; c < 4; c++)
+		{
+			if (c == largest)
+				continue;
+			float value = glm::clamp(components[c] * sign, -SMALLEST_THREE_RANGE, SMALLEST_THREE_RANGE);
+			packed |= (uint64_t)glm::round((value + SMALLEST_THREE_RANGE) * scale) << shift;
+			shift += result.componentBits;
+		}
+
+		for (int word = 0; word < result.wordsPerKey; word++)
+			result.values.push_back((uint16_t)(packed >> (16 * word)));
+	}
+	return result;
+}
+
+// Reduce a channel whose keys all lie within tolerance of the first one to that single key
+template <class T>
+void collapseConstantChannel(KeyChannel<T>& channel, float tolerance)
+{
+	for (size_t index = 1; index < channel.size(); ++index)
+	{
+		if (keyDistance(channel.values[0], channel.values[index]) > tolerance)
+			return;
+	}
+
+	channel.values.resize(1);
+	channel.values.shrink_to_fit();
+	if (!channel.times.empty()) {
+		channel.times.resize(1);
+		channel.times.shrink_to_fit();
+	}
+}
+
+template <class Channel>
+size_t getChannelMemory(const Channel& channel)
+{
+	return channel.times.capacity() * sizeof(float) + channel.values.capacity() * sizeof(channel.values[0]);
+}
+
+#endif
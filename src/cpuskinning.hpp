@@ -0,0 +1,121 @@
+#ifndef CPUSKINNING_HPP
+#define CPUSKINNING_HPP
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <chrono>
+#include <vector>
+
+#include "jobpool.hpp"
+#include "mesh.hpp"
+#include "simd.hpp"
+
+// Positions and normals of a mesh after skinning, one per vertex of the mesh
+struct SkinnedMesh
+{
+	std::vector<glm::vec3> vertices;
+	std::vector<glm::vec3> normals;
+};
+
+// Skin the vertices [begin, end) of the mesh with the palette, the way default.vert does.
+// The matrices of the up to four bones of a vertex are weighted and summed SIMD_LANES floats
+// at a time, then the sum transforms the position and normal. The shader leaves the summed
+// weight in gl_Position.w, so positions are divided by it to land where they are drawn. Like
+// in the shader, normals are not normalized and a vertex with a bone outside the palette
+// keeps its bind pose.
+void skinVertices(const Mesh& mesh, const glm::mat4* palette, int boneCount, size_t begin, size_t end, SkinnedMesh& result)
+{
+	const int MATRIX_LANES = 16 / SIMD_LANES;
+	alignas(SIMD_ALIGN) float blended[16];
+
+	for (size_t vertex = begin; vertex < end; vertex++)
+	{
+		const glm::ivec4& boneIds = mesh.boneIDs[vertex];
+		const glm::vec4& weights = mesh.weights[vertex];
+
+		FloatLanes sum[MATRIX_LANES];
+		for (int lane = 0; lane < MATRIX_LANES; lane++)
+			sum[lane] = lanesSet(0.0f);
+
+		bool outside = false;
+		for (int i = 0; i < 4; i++)
+		{
+			int bone = boneIds[i];
+			if (bone == -1)
+				continue;
+			if (bone >= boneCount) {
+				outside = true;
+				break;
+			}
+			const float* matrix = glm::value_ptr(palette[bone]);
+			FloatLanes weight = lanesSet(weights[i]);
+			for (int lane = 0; lane < MATRIX_LANES; lane++)
+				sum[lane] = lanesAdd(sum[lane], lanesMul(lanesLoadUnaligned(matrix + lane * SIMD_LANES), weight));
+		}
+
+		if (outside) {
+			result.vertices[vertex] = mesh.vertices[vertex];
+			result.normals[vertex] = mesh.normals[vertex];
+			continue;
+		}
+
+		for (int lane = 0; lane < MATRIX_LANES; lane++)
+			lanesStore(blended + lane * SIMD_LANES, sum[lane]);
+		const glm::vec3& position = mesh.vertices[vertex];
+		const glm::vec3& normal = mesh.normals[vertex];
+		glm::vec3 column0(blended[0], blended[1], blended[2]);
+		glm::vec3 column1(blended[4], blended[5], blended[6]);
+		glm::vec3 column2(blended[8], blended[9], blended[10]);
+		glm::vec3 column3(blended[12], blended[13], blended[14]);
+		glm::vec3 skinned = column0 * position.x + column1 * position.y + column2 * position.z + column3;
+		// Palettes are affine, so the bottom right entry holds the summed weight
+		result.vertices[vertex] = blended[15] != 0.0f ? skinned / blended[15] : skinned;
+		result.normals[vertex] = column0 * normal.x + column1 * normal.y + column2 * normal.z;
+	}
+}
+
+// Linear blend skinning of meshes on the CPU, for hit detection and capture on machines
+// without a GPU. The vertices are split in ranges over a pool of worker threads.
+class CpuSkinner
+{
+public:
+	// threadCount includes the calling thread, 0 uses every hardware thread
+	CpuSkinner(unsigned int threadCount = 0, size_t grain = 1024) : pool(threadCount)
+	{
+		this->grain = grain;
+	}
+
+	// Skin every vertex of the mesh with the first boneCount matrices of the palette
+	void skin(const Mesh& mesh, const glm::mat4* palette, int boneCount, SkinnedMesh& result)
+	{
+		size_t count = mesh.vertices.size();
+		result.vertices.resize(count);
+		result.normals.resize(count);
+		auto skinRange = [&](size_t begin, size_t end) {
+			skinVertices(mesh, palette, boneCount, begin, end, result);
+		};
+		pool.parallelFor(count, grain, skinRange);
+	}
+
+	// Vertices skinned per second over a number of runs of skin()
+	double measureThroughput(const Mesh& mesh, const glm::mat4* palette, int boneCount, int runs)
+	{
+		typedef std::chrono::high_resolution_clock Clock;
+		SkinnedMesh result;
+		skin(mesh, palette, boneCount, result);
+		Clock::time_point start = Clock::now();
+		for (int run = 0; run < runs; run++)
+			skin(mesh, palette, boneCount, result);
+		double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+		return seconds > 0.0 ? (double)mesh.vertices.size() * runs / seconds : 0.0;
+	}
+
+	unsigned int getThreadCount() const { return pool.getThreadCount(); }
+
+private:
+	JobPool pool;
+	size_t grain;
+};
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef INERTIALIZATION_HPP
+#define INERTIALIZATION_HPP
+
+#include <glm/glm.hpp>
+#include <glm/gtx/quaternion.hpp>
+
+#include <vector>
+
+#include "pose.hpp"
+
+// Offset of one channel of one node that decays to zero. The offset keeps its direction
+// (axis for rotations) and its length follows a quintic that starts at the offset and
+// velocity of the old animation and lands on zero with zero velocity and acceleration.
+struct InertialDecay
+{
+	glm::vec3 axis;
+	float x0;
+	float v0;
+	float a0;
+	float a;
+	float b;
+	float c;
+	float duration;
+};
+
+// x0 is the offset length now, previousX the offset along the same axis one step of dt earlier
+InertialDecay createDecay(const glm::vec3& axis, float x0, float previousX, float dt, float duration)
+{
+	InertialDecay decay;
+	decay.axis = axis;
+	decay.x0 = x0;
+	decay.v0 = dt > 0.0f ? (x0 - previousX) / dt : 0.0f;
+	decay.a0 = decay.a = decay.b = decay.c = 0.0f;
+	decay.duration = 0.0f;
+	if (x0 <= 0.0f)
+		return decay;
+
+	// Moving away from the target would overshoot, and moving towards it quickly shortens the decay
+	decay.v0 = glm::min(decay.v0, 0.0f);
+	float t1 = decay.v0 < 0.0f ? glm::min(duration, -5.0f * x0 / decay.v0) : duration;
+	float v0 = decay.v0;
+
+	decay.a0 = (-8.0f * v0 * t1 - 20.0f * x0) / (t1 * t1);
+	decay.a = -(decay.a0 * t1 * t1 + 6.0f * v0 * t1 + 12.0f * x0) / (2.0f * glm::pow(t1, 5.0f));
+	decay.b = (3.0f * decay.a0 * t1 * t1 + 16.0f * v0 * t1 + 30.0f * x0) / (2.0f * glm::pow(t1, 4.0f));
+	decay.c = -(3.0f * decay.a0 * t1 * t1 + 12.0f * v0 * t1 + 20.0f * x0) / (2.0f * t1 * t1 * t1);
+	decay.duration = t1;
+	return decay;
+}
+
+float evaluateDecay(const InertialDecay& decay, float t)
+{
+	if (t >= decay.duration)
+		return 0.0f;
+	return (((((decay.a * t + decay.b) * t + decay.c) * t + 0.5f * decay.a0) * t + decay.v0) * t) + decay.x0;
+}
+
+InertialDecay createVectorDecay(const glm::vec3& source, const glm::vec3& previousSource, const glm::vec3& target, float dt, float duration)
+{
+	glm::vec3 offset = source - target;
+	float length = glm::length(offset);
+	glm::vec3 axis = length > 1e-6f ? offset / length : glm::vec3(1.0f, 0.0f, 0.0f);
+	return createDecay(axis, length > 1e-6f ? length : 0.0f, glm::dot(previousSource - target, axis), dt, duration);
+}
+
+InertialDecay createRotationDecay(const glm::quat& source, const glm::quat& previousSource, const glm::quat& target, float dt, float duration)
+{
+	// source = offset * target
+	glm::quat offset = source * glm::inverse(target);
+	if (offset.w < 0.0f)
+		offset = -offset;
+	glm::vec3 vector(offset.x, offset.y, offset.z);
+	float sine = glm::length(vector);
+	if (sine < 1e-6f)
+		return createDecay(glm::vec3(1.0f, 0.0f, 0.0f), 0.0f, 0.0f, dt, duration);
+
+	glm::vec3 axis = vector / sine;
+	float angle = 2.0f * glm::atan(sine, offset.w);
+
+	glm::quat previousOffset = previousSource * glm::inverse(target);
+	if (previousOffset.w < 0.0f)
+		previousOffset = -previousOffset;
+	float previousAngle = 2.0f * glm::atan(glm::dot(glm::vec3(previousOffset.x, previousOffset.y, previousOffset.z), axis), previousOffset.w);
+	return createDecay(axis, angle, previousAngle, dt, duration);
+}
+
+// Offsets of the pose being left (with its pose dt seconds earlier) against the pose of the
+// new animation, three decays per node for translation, rotation and scale
+void inertializePose(const Pose& source, const Pose& previousSource, const Pose& target, float dt, float duration, std::vector<InertialDecay>& decays)
+{
+	decays.resize(target.size() * 3);
+	for (size_t node = 0; node < target.size(); node++)
+	{
+		decays[node * 3] = createVectorDecay(source[node].translation, previousSource[node].translation, target[node].translation, dt, duration);
+		decays[node * 3 + 1] = createRotationDecay(source[node].rotation, previousSource[node].rotation, target[node].rotation, dt, duration);
+		decays[node * 3 + 2] = createVectorDecay(source[node].scale, previousSource[node].scale, target[node].scale, dt, duration);
+	}
+}
+
+// Add the remaining offsets, time seconds after the switch, to a pose of the new animation
+void applyInertialization(const std::vector<InertialDecay>& decays, float time, Pose& pose)
+{
+	for (size_t node = 0; node < pose.size(); node++)
+	{
+		const InertialDecay* decay = &decays[node * 3];
+		if (time < decay[0].duration)
+			pose[node].translation += decay[0].axis * evaluateDecay(decay[0], time);
+		if (time < decay[1].duration)
+			pose[node].rotation = glm::angleAxis(evaluateDecay(decay[1], time), decay[1].axis) * pose[node].rotation;
+		if (time < decay[2].duration)
+			pose[node].scale += decay[2].axis * evaluateDecay(decay[2], time);
+	}
+}
+
+#endif
@@ -4,24 +4,64 @@
 #include <glm/glm.hpp>
 #include <glm/gtx/quaternion.hpp>
 
-struct KeyPosition
+#include <algorithm>
+#include <vector>
+
+// How rotation keys are interpolated. NLERP is cheaper and close to SLERP
+// for densely sampled clips, see Animation::getNlerpError().
+enum RotationInterpolation { SLERP, NLERP };
+
+// Keys of one channel. The timestamps are stored apart from the values,
+// so searching for a key only walks the time stream. Channels resampled
+// at a uniform rate (keys per tick) drop their timestamps entirely.
+template <class T>
+struct KeyChannel
 {
-	glm::vec3 position;
-	float timeStamp;
+	std::vector<float> times;
+	std::vector<T> values;
+	float rate = 0.0f;
+
+	size_t size() const { return values.size(); }
 };
 
-struct KeyRotation
+// Largest deviation per channel type: distance for positions and scales, radians for rotations
+struct TrackError
 {
-	glm::quat orientation;
-	float timeStamp;
+	float position = 0.0f;
+	float rotation = 0.0f;
+	float scale = 0.0f;
 };
 
-struct KeyScale
+void accumulateError(TrackError& total, const TrackError& error)
 {
-	glm::vec3 scale;
-	float timeStamp;
-};
+	total.position = glm::max(total.position, error.position);
+	total.rotation = glm::max(total.rotation, error.rotation);
+	total.scale = glm::max(total.scale, error.scale);
+}
+
+// Find the index of the key pair [index, index + 1] surrounding animationTime.
+// The cursor remembers the last result, so forward playback only has to check the
+// current and the next key. Any other jump (seek, loop, transition) falls back to a
+// binary search over the timestamps.
+size_t findKeyIndex(const std::vector<float>& times, float animationTime, size_t& cursor)
+{
+	if (times.size() < 2)
+		return 0;
 
+	size_t last = times.size() - 2;
+	for (size_t index = cursor; index <= last && index <= cursor + 1; ++index)
+	{
+		if ((index == 0 || times[index] <= animationTime) && (index == last || animationTime < times[index + 1]))
+		{
+			cursor = index;
+			return index;
+		}
+	}
+
+	auto it = std::upper_bound(times.begin() + 1, times.end() - 1, animationTime);
+	cursor = it - (times.begin() + 1);
+	return cursor;
+}
 
 float getScaleFactor(float lastTimeStamp, float nextTimeStamp, float animationTime)
 {
@@ -32,27 +72,189 @@ float getScaleFactor(float lastTimeStamp, float nextTimeStamp, float animationTi
 	return scaleFactor;
 }
 
-glm::mat4 interpolatePosition(float animationTime, KeyPosition from, KeyPosition to)
+// The functions below accept a channel of any storage format (see also compression.hpp).
+// They only rely on its times, rate, size() and a matching decodeKey().
+
+template <class T>
+const T& decodeKey(const KeyChannel<T>& channel, size_t index)
+{
+	return channel.values[index];
+}
+
+// Hook for formats that cannot keep consecutive rotation keys in one hemisphere
+template <class Channel, class T>
+void alignKeys(const Channel&, const T&, T&)
 {
-	float scaleFactor = getScaleFactor(from.timeStamp, to.timeStamp, animationTime);
-	glm::vec3 finalPosition = glm::mix(from.position, to.position, scaleFactor);
-	glm::mat4 translation = glm::translate(glm::mat4(1.0f), finalPosition);
-	return translation;
 }
 
-glm::mat4 interpolateRotation(float animationTime, KeyRotation from, KeyRotation to)
+template <class Channel>
+float getKeyTime(const Channel& channel, size_t index)
 {
-	float scaleFactor = getScaleFactor(from.timeStamp, to.timeStamp, animationTime);
-	glm::quat finalRotation = glm::slerp(from.orientation, to.orientation, scaleFactor);
-	finalRotation = glm::normalize(finalRotation);
-	return glm::toMat4(finalRotation);
+	return channel.rate > 0.0f ? index / channel.rate : channel.times[index];
 }
 
-glm::mat4 interpolateScaling(float animationTime, KeyScale from, KeyScale to)
+// Uniform channels address their keys directly, keyed channels search the timestamps
+template <class Channel>
+size_t findKeyIndex(const Channel& channel, float animationTime, size_t& cursor)
 {
-	float scaleFactor = getScaleFactor(from.timeStamp, to.timeStamp, animationTime);
-	glm::vec3 finalScale = glm::mix(from.scale, to.scale, scaleFactor);
-	return glm::scale(glm::mat4(1.0f), finalScale);
+	if (channel.rate > 0.0f && channel.size() > 1)
+		return std::min((size_t)glm::max(animationTime * channel.rate, 0.0f), channel.size() - 2);
+	return findKeyIndex(channel.times, animationTime, cursor);
+}
+
+// Fetch the key pair surrounding animationTime and the factor to interpolate them with
+template <class Channel, class T>
+void findKeys(const Channel& channel, float animationTime, size_t& cursor, T& from, T& to, float& factor)
+{
+	if (channel.size() == 1)
+	{
+		from = to = decodeKey(channel, 0);
+		factor = 0.0f;
+		return;
+	}
+
+	size_t index = findKeyIndex(channel, animationTime, cursor);
+	from = decodeKey(channel, index);
+	to = decodeKey(channel, index + 1);
+	alignKeys(channel, from, to);
+	if (channel.rate > 0.0f)
+		factor = animationTime * channel.rate - index;
+	else
+		factor = getScaleFactor(channel.times[index], channel.times[index + 1], animationTime);
+}
+
+glm::vec3 interpolateKeys(const glm::vec3& from, const glm::vec3& to, float factor)
+{
+	return glm::mix(from, to, factor);
+}
+
+glm::quat interpolateKeys(const glm::quat& from, const glm::quat& to, float factor)
+{
+	return glm::normalize(glm::slerp(from, to, factor));
+}
+
+float keyDistance(const glm::vec3& a, const glm::vec3& b)
+{
+	return glm::length(a - b);
+}
+
+// Angle in radians between two orientations
+float keyDistance(const glm::quat& a, const glm::quat& b)
+{
+	glm::quat difference = glm::conjugate(a) * b;
+	return 2.0f * glm::atan(glm::length(glm::vec3(difference.x, difference.y, difference.z)), glm::abs(difference.w));
+}
+
+// Value of the channel at animationTime, using the reference interpolation
+template <class T, class Channel>
+T evaluateChannel(const Channel& channel, float animationTime)
+{
+	size_t cursor = 0;
+	T from, to;
+	float factor;
+	findKeys(channel, animationTime, cursor, from, to, factor);
+	return interpolateKeys(from, to, factor);
+}
+
+// Largest difference between two versions of a channel, checked at every
+// key of the original and halfway between them
+template <class T, class Channel>
+float measureChannelError(const KeyChannel<T>& original, const Channel& approximation)
+{
+	float maxError = 0.0f;
+	for (size_t index = 0; index < original.size(); ++index)
+	{
+		float time = getKeyTime(original, index);
+		maxError = glm::max(maxError, keyDistance(evaluateChannel<T>(original, time), evaluateChannel<T>(approximation, time)));
+		if (index + 1 < original.size()) {
+			time = 0.5f * (time + getKeyTime(original, index + 1));
+			maxError = glm::max(maxError, keyDistance(evaluateChannel<T>(original, time), evaluateChannel<T>(approximation, time)));
+		}
+	}
+	return maxError;
+}
+
+// Resample a channel at evenly spaced keys, roughly keysPerTick apart. The rate is
+// adjusted so the last key lands exactly on the end of the clip.
+template <class T>
+KeyChannel<T> resampleChannel(const KeyChannel<T>& channel, float duration, float keysPerTick)
+{
+	KeyChannel<T> result;
+	if (channel.size() == 1 || duration <= 0.0f) {
+		result.values = channel.values;
+		result.rate = keysPerTick;
+		return result;
+	}
+
+	size_t frames = std::max((size_t)1, (size_t)std::round(duration * keysPerTick));
+	result.rate = frames / duration;
+	result.values.reserve(frames + 1);
+	for (size_t frame = 0; frame <= frames; ++frame)
+		result.values.push_back(evaluateChannel<T>(channel, frame / result.rate));
+	return result;
+}
+
+// Whether every key of the channel holds exactly the same value
+template <class T>
+bool isChannelConstant(const KeyChannel<T>& channel)
+{
+	for (size_t index = 1; index < channel.size(); ++index)
+	{
+		if (channel.values[index] != channel.values[0])
+			return false;
+	}
+	return true;
+}
+
+// Remove the keys that interpolating their neighbours reproduces within tolerance
+// (a distance for vectors, radians for rotations). Keys are only ever dropped, the
+// remaining ones keep their original values. Returns the number of keys removed.
+template <class T>
+size_t reduceChannel(KeyChannel<T>& channel, float tolerance)
+{
+	size_t count = channel.size();
+	if (channel.rate > 0.0f || count < 2)
+		return 0;
+
+	KeyChannel<T> result;
+	result.times.push_back(channel.times[0]);
+	result.values.push_back(channel.values[0]);
+
+	size_t anchor = 0;
+	while (anchor + 1 < count)
+	{
+		// Stretch the segment from the anchor as far as every skipped key allows. Both
+		// curves are piecewise linear, so checking at the original keys is enough.
+		size_t end = anchor + 1;
+		while (end + 1 < count)
+		{
+			size_t candidate = end + 1;
+			float startTime = channel.times[anchor];
+			float length = channel.times[candidate] - startTime;
+			bool fits = true;
+			for (size_t index = anchor + 1; index < candidate && fits; ++index)
+			{
+				T value = interpolateKeys(channel.values[anchor], channel.values[candidate], (channel.times[index] - startTime) / length);
+				fits = keyDistance(value, channel.values[index]) <= tolerance;
+			}
+			if (!fits)
+				break;
+			end = candidate;
+		}
+		result.times.push_back(channel.times[end]);
+		result.values.push_back(channel.values[end]);
+		anchor = end;
+	}
+
+	// A channel that barely moves is held at its first key
+	if (result.size() == 2 && keyDistance(result.values[0], result.values[1]) <= tolerance)
+	{
+		result.times.pop_back();
+		result.values.pop_back();
+	}
+
+	std::swap(channel, result);
+	return count - channel.size();
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,183 @@
+#ifndef JOBPOOL_HPP
+#define JOBPOOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads running ranges of a parallel loop. Every thread owns a
+// queue of jobs, takes its newest job first and steals the oldest job of another
+// thread when it runs dry. The calling thread works along until the loop is done.
+class JobPool
+{
+public:
+	// threadCount includes the calling thread, 0 uses every hardware thread
+	JobPool(unsigned int threadCount = 0)
+	{
+		if (threadCount == 0)
+			threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+		queued = 0;
+		remaining = 0;
+		stopping = false;
+
+		for (unsigned int i = 0; i < threadCount; i++)
+			queues.push_back(std::unique_ptr<JobQueue>(new JobQueue()));
+		// The last queue belongs to the thread calling parallelFor()
+		for (unsigned int i = 0; i + 1 < threadCount; i++)
+			threads.push_back(std::thread(&JobPool::workerLoop, this, i));
+	}
+
+	~JobPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (auto& thread : threads)
+			thread.join();
+	}
+
+	JobPool(const JobPool&) = delete;
+	JobPool& operator=(const JobPool&) = delete;
+
+	unsigned int getThreadCount() const { return (unsigned int)queues.size(); }
+
+	// Call body(begin, end) over [0, count) in chunks of at most grain items, and
+	// return once every chunk has run. Only one thread may call this at a time.
+	template <class Body>
+	void parallelFor(size_t count, size_t grain, Body& body)
+	{
+		run(count, grain, &invokeBody<Body>, &body);
+	}
+
+private:
+	typedef void (*JobFunction)(void* context, size_t begin, size_t end);
+
+	struct Job
+	{
+		JobFunction function;
+		void* context;
+		size_t begin;
+		size_t end;
+	};
+
+	// Jobs [first, size) are waiting, the owner pops from the back and thieves take the first.
+	// The vector is only cleared between loops, so it stops allocating once large enough.
+	struct JobQueue
+	{
+		std::mutex mutex;
+		std::vector<Job> jobs;
+		size_t first = 0;
+	};
+
+	std::vector<std::unique_ptr<JobQueue>> queues;
+	std::vector<std::thread> threads;
+	std::mutex sleepMutex;
+	std::condition_variable wake;
+	std::condition_variable finished;
+	// Jobs waiting in a queue, and jobs not finished yet
+	std::atomic<size_t> queued;
+	std::atomic<size_t> remaining;
+	bool stopping;
+
+	template <class Body>
+	static void invokeBody(void* context, size_t begin, size_t end)
+	{
+		(*static_cast<Body*>(context))(begin, end);
+	}
+
+	void run(size_t count, size_t grain, JobFunction function, void* context)
+	{
+		if (count == 0)
+			return;
+		grain = std::max((size_t)1, grain);
+
+		// Deal the chunks out round robin, each thread starts on a contiguous share
+		size_t chunks = (count + grain - 1) / grain;
+		size_t threadCount = queues.size();
+		remaining = chunks;
+		for (size_t thread = 0; thread < threadCount; thread++)
+		{
+			std::lock_guard<std::mutex> lock(queues[thread]->mutex);
+			// Every job of the previous loop has been taken
+			queues[thread]->jobs.clear();
+			queues[thread]->first = 0;
+			size_t first = chunks * thread / threadCount, last = chunks * (thread + 1) / threadCount;
+			// Pushed last to first, so the owner pops them in order from the back
+			for (size_t chunk = last; chunk-- > first;)
+				queues[thread]->jobs.push_back({ function, context, chunk * grain, std::min(count, (chunk + 1) * grain) });
+			queued += last - first;
+		}
+
+		{
+			// Taking the lock makes sure no worker is between checking queued and going to sleep
+			std::lock_guard<std::mutex> lock(sleepMutex);
+		}
+		wake.notify_all();
+
+		size_t self = threadCount - 1;
+		while (runJob(self))
+			;
+
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		finished.wait(lock, [this]() { return remaining == 0; });
+	}
+
+	bool takeJob(size_t self, Job& job)
+	{
+		for (size_t offset = 0; offset < queues.size(); offset++)
+		{
+			JobQueue& queue = *queues[(self + offset) % queues.size()];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if (queue.first == queue.jobs.size())
+				continue;
+			if (offset == 0) {
+				job = queue.jobs.back();
+				queue.jobs.pop_back();
+			}
+			else {
+				job = queue.jobs[queue.first++];
+			}
+			queued--;
+			return true;
+		}
+		return false;
+	}
+
+	bool runJob(size_t self)
+	{
+		Job job;
+		if (!takeJob(self, job))
+			return false;
+
+		job.function(job.context, job.begin, job.end);
+		if (--remaining == 0) {
+			std::lock_guard<std::mutex> lock(sleepMutex);
+			finished.notify_all();
+		}
+		return true;
+	}
+
+	void workerLoop(size_t self)
+	{
+		while (true)
+		{
+			{
+				std::unique_lock<std::mutex> lock(sleepMutex);
+				wake.wait(lock, [this]() { return stopping || queued > 0; });
+				if (stopping)
+					return;
+			}
+			while (runJob(self))
+				;
+		}
+	}
+};
+
+#endif
@@ -14,19 +14,23 @@
 #include "helper.hpp"
 #include "animation.hpp"
 #include "animator.hpp"
+#include "animationworld.hpp"
+#include "blendspace.hpp"
+#include "palettebuffer.hpp"
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
-void processInput(GLFWwindow* window, Animation* animations);
+void processInput(GLFWwindow* window, Animation** animations, const BlendSpace* locomotion);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void renderNode(Node* node);
 void updateNodeTransformations(Node* node, glm::mat4 transformationThusFar);
-void setUniformBoneTransforms(std::vector<glm::mat4> transforms, unsigned int shaderId);
 
 bool VSYNC = true;
 bool FULLSCREEN = false;
 int WINDOW_WIDTH = 1920;
 int WINDOW_HEIGHT = 1080;
 int FPS = 999999;
+// Skin with dual quaternions instead of blended matrices, unless a clip scales bones
+bool DUAL_QUATERNION_SKINNING = false;
 
 glm::vec3 cameraPos = glm::vec3(1.0f, 2.0f, 3.0f);
 glm::vec3 cameraFront = glm::vec3(0.0f, 0.0f, -1.0f);
@@ -41,7 +45,12 @@ float fov = 45.0f;
 
 float deltaTime = 0.0f;
 
-Animator animator = Animator();
+// Walking velocity of the character, x to its left and y forward
+glm::vec2 velocity = glm::vec2(0.0f);
+
+// Only the player character is animated for now
+AnimationWorld world(1);
+Animator& animator = world.getAnimator(world.addAnimator());
 
 Node* checkerFloor = createSceneNode();
 Node* character = createSceneNode();
@@ -184,10 +193,34 @@ int main()
 	Animation anim5(animFile5, &m);
 	Animation anim6(animFile6, &m);
 
-	Animation animations[] = { anim1, anim2, anim3, anim4, anim5, anim6 };
+	Animation* animations[] = { &anim1, &anim2, &anim3, &anim4, &anim5, &anim6 };
+
+	// Idle and walking clips placed at the velocity they move at
+	BlendSpace locomotion;
+	locomotion.addSample(&anim1, glm::vec2(0.0f, 0.0f), false);
+	locomotion.addSample(&anim2, glm::vec2(0.0f, 0.75f));
+	locomotion.addSample(&anim3, glm::vec2(-0.75f, 0.0f));
+	locomotion.addSample(&anim4, glm::vec2(0.75f, 0.0f));
+	locomotion.addSample(&anim5, glm::vec2(0.0f, -0.5f));
+	locomotion.triangulate();
+
+	// Palettes are read by the shaders from a storage buffer sized for the bones of the rig
+	assert(m.boneProps.size() <= MAX_BONES);
+	PaletteBuffer paletteBuffer(world.getInstanceCount(), (int)m.boneProps.size());
+	// Palettes are affine, leave out the bottom row. Dual quaternions hold no scale, so clips
+	// with scale keys are skinned with matrices.
+	PaletteFormat paletteFormat = DUAL_QUATERNION_SKINNING ? PALETTE_DUAL_QUAT : PALETTE_AFFINE;
+	for (Animation* animation : animations) {
+		if (paletteFormat == PALETTE_DUAL_QUAT && animation->hasScaleKeys()) {
+			std::cout << "Scale keys up to " << animation->getScaleDeviation() << " from one, using linear blend skinning" << std::endl;
+			paletteFormat = PALETTE_AFFINE;
+		}
+	}
+	animator.setPaletteFormat(paletteFormat);
 
-	Shader shader = Shader("../src/shaders/default.vert", "../src/shaders/default.frag");
-	Shader depthShader = Shader("../src/shaders/depth.vert", "../src/shaders/depth.frag");
+	bool dualQuaternions = paletteFormat == PALETTE_DUAL_QUAT;
+	Shader shader = Shader(dualQuaternions ? "../src/shaders/default_dq.vert" : "../src/shaders/default.vert", "../src/shaders/default.frag");
+	Shader depthShader = Shader(dualQuaternions ? "../src/shaders/depth_dq.vert" : "../src/shaders/depth.vert", "../src/shaders/depth.frag");
 
 	// Render loop
 	float frameTime = 1.0f / FPS;
@@ -213,13 +246,15 @@ int main()
 		std::cout << "FPS: " << (1.0f / deltaTime) << "\t\r" << std::flush;
 		lastFrame = now;
 
-		processInput(window, animations);
-		animator.updateAnimation(deltaTime);
+		processInput(window, animations, &locomotion);
+		world.updateAnimations(deltaTime);
 
 		updateNodeTransformations(root, glm::mat4(1.0));
 
-		auto transforms = animator.getFinalBoneMatrices();
-
+		// The binding holds for both passes
+		paletteBuffer.beginFrame();
+		paletteBuffer.upload(0, world.getPalette(0), animator.getPaletteFormat());
+		paletteBuffer.bind(0);
 
 
 		// ----------------- Shadow ---------------
@@ -230,8 +265,8 @@ int main()
 		glm::mat4 lightSpaceMatrix = lightProjection * lightView;
 
 		depthShader.use();
-
-		setUniformBoneTransforms(transforms, depthShader.ID);
+		if (!dualQuaternions)
+			glUniform1ui(10, paletteBuffer.getFormat(0));
 
 		glUniformMatrix4fv(1, 1, GL_FALSE, glm::value_ptr(lightSpaceMatrix));
 
@@ -246,11 +281,11 @@ int main()
 		glCullFace(GL_BACK);
 
 		shader.use();
+		if (!dualQuaternions)
+			glUniform1ui(10, paletteBuffer.getFormat(0));
 
 		// ---------------- Shadow End ------------
 
-		setUniformBoneTransforms(transforms, shader.ID);
-
 		glClearColor(0.5f, 1.0f, 0.5f, 1.0f);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 		glViewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
@@ -271,6 +306,8 @@ int main()
 		glBindVertexArray(0);
 		glBindTexture(GL_TEXTURE_2D, 0);
 
+		paletteBuffer.endFrame();
+
 		glfwSwapBuffers(window);
 		glfwPollEvents();
 	}
@@ -283,14 +320,6 @@ int main()
 	return 0;
 }
 
-void setUniformBoneTransforms(std::vector<glm::mat4> transforms, unsigned int shaderId) {
-	for (int i = 0; i < transforms.size(); ++i) {
-		string boneStr = "boneTransforms[" + std::to_string(i) + "]";
-		int boneLocation = glGetUniformLocation(shaderId, boneStr.c_str());
-		glUniformMatrix4fv(boneLocation, 1, GL_FALSE, glm::value_ptr(transforms[i]));
-	}
-}
-
 void updateNodeTransformations(Node* node, glm::mat4 transformationThusFar)
 {
 	glm::mat4 transformationMatrix =
@@ -359,7 +388,7 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 	glViewport(0, 0, width, height);
 }
 
-void processInput(GLFWwindow* window, Animation* animations)
+void processInput(GLFWwindow* window, Animation** animations, const BlendSpace* locomotion)
 {
 	if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
 		glfwSetWindowShouldClose(window, true);
@@ -369,48 +398,35 @@ void processInput(GLFWwindow* window, Animation* animations)
 
 	float speed = 2.0f * deltaTime;
 
-	bool idle = true;
+	glm::vec2 targetVelocity = glm::vec2(0.0f);
+	if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
+		targetVelocity.y += 0.75f;
+	if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
+		targetVelocity.y -= 0.5f;
+	if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
+		targetVelocity.x += 0.75f;
+	if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
+		targetVelocity.x -= 0.75f;
 
-	if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) {
-		character->position.z += 0.75f * speed;
-		cameraPos.z += 0.75f * speed;
-		animator.playAnimation(&animations[1]);
-		idle = false;
-		//cameraPos += glm::normalize(glm::vec3(cameraFront.x, 0, cameraFront.z)) * speed;
-	}
-	else if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) {
-		character->position.z -= 0.5f * speed;
-		cameraPos.z -= 0.5f * speed;
-		animator.playAnimation(&animations[4]);
-		idle = false;
-		//cameraPos -= glm::normalize(glm::vec3(cameraFront.x, 0, cameraFront.z)) * speed;
-	}
-	else if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS) {
-		character->position.x += 0.75f * speed;
-		cameraPos.x += 0.75f * speed;
-		animator.playAnimation(&animations[3]);
-		idle = false;
-		//cameraPos -= glm::normalize(glm::cross(cameraFront, cameraUp)) * speed;
-	}
-	else if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) {
-		character->position.x -= 0.75f * speed;
-		cameraPos.x -= 0.75f * speed;
-		animator.playAnimation(&animations[2]);
-		idle = false;
-		//cameraPos += glm::normalize(glm::cross(cameraFront, cameraUp)) * speed;
-	}
-	else if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS) {
-		animator.playAnimation(&animations[5]);
-		idle = false;
-	}
+	// Ease into the new velocity so the blend space glides between its clips
+	velocity += (targetVelocity - velocity) * glm::min(1.0f, 10.0f * deltaTime);
+
+	character->position.x += velocity.x * speed;
+	character->position.z += velocity.y * speed;
+	cameraPos.x += velocity.x * speed;
+	cameraPos.z += velocity.y * speed;
 
 	if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS)
 	{
 		glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 	}
 
-	if (idle) {
-		animator.playAnimation(&animations[0]);
+	if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS) {
+		animator.playAnimation(animations[5]);
+	}
+	else {
+		animator.setBlendParameter(velocity);
+		animator.playBlendSpace(locomotion);
 	}
 }
 
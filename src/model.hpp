@@ -12,12 +12,14 @@
 #include <assimp/postprocess.h>
 
 #include "mesh.hpp"
+#include "skeleton.hpp"
 
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <vector>
 using namespace std;
 
@@ -53,6 +55,7 @@ public:
 	vector<unsigned int> heightMaps;
 
 	std::vector<BoneProps> boneProps;
+	std::shared_ptr<Skeleton> skeleton;
 
 	int boneCounter = 0;
 
@@ -70,6 +73,13 @@ public:
 		directory = path.substr(0, path.find_last_of('/'));
 
 		processNode(scene->mRootNode, scene);
+
+		skeleton = std::make_shared<Skeleton>();
+		processSkeleton(scene->mRootNode, -1);
+		// Reset all root transformations
+		skeleton->localBindTransforms[0] = glm::mat4(1.0f);
+		for (unsigned int i = 0; i < skeleton->localBindTransforms.size(); i++)
+			skeleton->bindPose.push_back(decomposeTransform(skeleton->localBindTransforms[i]));
 	}
 
 private:
@@ -136,6 +146,19 @@ private:
 		}
 	}
 
+	void processSkeleton(aiNode* node, int parent)
+	{
+		int index = skeleton->getNodeCount();
+		skeleton->names.push_back(node->mName.C_Str());
+		skeleton->parents.push_back(parent);
+		skeleton->localBindTransforms.push_back(aiMatrix4x4ToGlm(&node->mTransformation));
+
+		for (unsigned int i = 0; i < node->mNumChildren; i++)
+		{
+			processSkeleton(node->mChildren[i], index);
+		}
+	}
+
 	Mesh processMesh(aiMesh* mesh, const aiScene* scene)
 	{
 		// Mesh to fill with data
@@ -0,0 +1,142 @@
+#ifndef PALETTEBUFFER_HPP
+#define PALETTEBUFFER_HPP
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <cstring>
+#include <vector>
+
+#include "paletteformat.hpp"
+
+// Bone palettes of several characters in one persistently mapped shader storage buffer, each
+// encoded in the format of its character, see PaletteFormat. The buffer holds three regions
+// written in turn, one per frame, and each region is fenced when its frame is submitted.
+// Writing a region first waits for the GPU to finish the frame that last read it, three
+// frames back, which rarely blocks. Each character has a slot of boneCount full matrices in
+// every region, the compact formats only write and bind part of it.
+//
+// A palette equal to the one uploaded before is not copied again once every region holds it,
+// so characters that stand still cost nothing after three frames.
+class PaletteBuffer
+{
+public:
+	static const int REGION_COUNT = 3;
+
+	PaletteBuffer(int paletteCount, int boneCount, unsigned int binding = 0)
+	{
+		this->paletteCount = paletteCount;
+		this->boneCount = boneCount;
+		this->binding = binding;
+		region = 0;
+		uploads = 0;
+		skippedUploads = 0;
+
+		GLint alignment = 1;
+		glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		slotSize = (boneCount * sizeof(glm::mat4) + alignment - 1) / alignment * alignment;
+		regionSize = slotSize * paletteCount;
+
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+		glBufferStorage(GL_SHADER_STORAGE_BUFFER, regionSize * REGION_COUNT, nullptr, flags);
+		mapped = (char*)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, regionSize * REGION_COUNT, flags);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		for (int i = 0; i < REGION_COUNT; i++)
+			fences[i] = 0;
+		lastPalettes.assign((size_t)paletteCount * boneCount, glm::mat4(0.0f));
+		validRegions.assign(paletteCount, 0);
+		formats.assign(paletteCount, PALETTE_MAT4);
+	}
+
+	~PaletteBuffer()
+	{
+		for (int i = 0; i < REGION_COUNT; i++) {
+			if (fences[i])
+				glDeleteSync(fences[i]);
+		}
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+		glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		glDeleteBuffers(1, &buffer);
+	}
+
+	// Move on to the next region, waiting until the GPU no longer reads it
+	void beginFrame()
+	{
+		region = (region + 1) % REGION_COUNT;
+		GLsync& fence = fences[region];
+		if (!fence)
+			return;
+		GLenum result = glClientWaitSync(fence, 0, 0);
+		while (result == GL_TIMEOUT_EXPIRED)
+			result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+		glDeleteSync(fence);
+		fence = 0;
+	}
+
+	// Encode the first boneCount matrices of the palette into the slot of this frame
+	void upload(int slot, const glm::mat4* palette, PaletteFormat format = PALETTE_MAT4)
+	{
+		glm::mat4* last = &lastPalettes[(size_t)slot * boneCount];
+		size_t size = boneCount * sizeof(glm::mat4);
+		if (std::memcmp(last, palette, size) != 0 || format != formats[slot]) {
+			std::memcpy(last, palette, size);
+			formats[slot] = format;
+			validRegions[slot] = 0;
+		}
+		// A bit per region that holds the latest palette
+		if (validRegions[slot] & (1 << region)) {
+			skippedUploads++;
+			return;
+		}
+		encodePalette(palette, boneCount, format, mapped + region * regionSize + slot * slotSize);
+		validRegions[slot] |= 1 << region;
+		uploads++;
+	}
+
+	// Expose the palette of the slot to shaders at the binding point, until the next bind
+	void bind(int slot)
+	{
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, buffer, region * regionSize + slot * slotSize, getSlotBytes(slot));
+	}
+
+	// Fence the region once every draw reading it has been issued
+	void endFrame()
+	{
+		fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+
+	int getBoneCount() const { return boneCount; }
+
+	PaletteFormat getFormat(int slot) const { return formats[slot]; }
+
+	// Bytes the palette of the slot takes in its format
+	size_t getSlotBytes(int slot) const { return (size_t)boneCount * getPaletteFormatWords(formats[slot]) * 4; }
+
+	size_t getUploadCount() const { return uploads; }
+
+	size_t getSkippedUploadCount() const { return skippedUploads; }
+
+private:
+	int paletteCount;
+	int boneCount;
+	unsigned int binding;
+	GLuint buffer;
+	char* mapped;
+	size_t slotSize;
+	size_t regionSize;
+	int region;
+	GLsync fences[REGION_COUNT];
+	// Last palette uploaded per slot, compared on the CPU as the mapping is write only
+	std::vector<glm::mat4> lastPalettes;
+	std::vector<int> validRegions;
+	std::vector<PaletteFormat> formats;
+	size_t uploads;
+	size_t skippedUploads;
+};
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef PALETTEFORMAT_HPP
+#define PALETTEFORMAT_HPP
+
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <cstdint>
+#include <cstring>
+
+// How a palette is laid out for the shaders, one set of 32 bit words per bone. Palette
+// matrices are affine, so AFFINE drops the constant bottom row and keeps the three other
+// rows. HALF packs those rows as half floats, which leaves about 0.05% relative error.
+// DUAL_QUAT stores the rotation and translation of each matrix as a unit dual quaternion,
+// real part then dual part, each as x, y, z, w. It is exact for rigid palettes only, any
+// scale in the matrices is lost, see Animation::hasScaleKeys().
+enum PaletteFormat { PALETTE_MAT4, PALETTE_AFFINE, PALETTE_HALF, PALETTE_DUAL_QUAT };
+
+// 32 bit words per bone
+int getPaletteFormatWords(PaletteFormat format)
+{
+	switch (format) {
+	case PALETTE_AFFINE:
+		return 12;
+	case PALETTE_HALF:
+		return 6;
+	case PALETTE_DUAL_QUAT:
+		return 8;
+	default:
+		return 16;
+	}
+}
+
+// Unit dual quaternion of the rotation and translation of an affine matrix
+void getDualQuaternion(const glm::mat4& matrix, glm::quat& real, glm::quat& dual)
+{
+	glm::mat3 rotation(glm::normalize(glm::vec3(matrix[0])), glm::normalize(glm::vec3(matrix[1])), glm::normalize(glm::vec3(matrix[2])));
+	real = glm::normalize(glm::quat_cast(rotation));
+	// Keep every bone in one hemisphere, the shaders still align each blend to its first bone
+	if (real.w < 0.0f)
+		real = -real;
+	dual = glm::quat(0.0f, glm::vec3(matrix[3])) * real * 0.5f;
+}
+
+// Write boneCount matrices in the format, as read back by getBoneTransform() in the shaders
+void encodePalette(const glm::mat4* palette, int boneCount, PaletteFormat format, void* destination)
+{
+	if (format == PALETTE_MAT4) {
+		memcpy(destination, palette, boneCount * sizeof(glm::mat4));
+		return;
+	}
+
+	float* floats = static_cast<float*>(destination);
+	uint32_t* words = static_cast<uint32_t*>(destination);
+	for (int bone = 0; bone < boneCount; bone++)
+	{
+		const glm::mat4& matrix = palette[bone];
+		if (format == PALETTE_AFFINE) {
+			for (int row = 0; row < 3; row++)
+				for (int column = 0; column < 4; column++)
+					*floats++ = matrix[column][row];
+		}
+		else if (format == PALETTE_DUAL_QUAT) {
+			glm::quat real, dual;
+			getDualQuaternion(matrix, real, dual);
+			const glm::quat parts[] = { real, dual };
+			for (const glm::quat& part : parts) {
+				*floats++ = part.x;
+				*floats++ = part.y;
+				*floats++ = part.z;
+				*floats++ = part.w;
+			}
+		}
+		else {
+			for (int row = 0; row < 3; row++) {
+				*words++ = glm::packHalf2x16(glm::vec2(matrix[0][row], matrix[1][row]));
+				*words++ = glm::packHalf2x16(glm::vec2(matrix[2][row], matrix[3][row]));
+			}
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef POSE_HPP
+#define POSE_HPP
+
+#include <glm/glm.hpp>
+#include <glm/gtx/quaternion.hpp>
+
+#include <vector>
+
+// Local transform of a node kept as translation, rotation and scale.
+// Sampling and blending work on these, matrices are only built once per node.
+struct Transform
+{
+	glm::vec3 translation;
+	glm::quat rotation;
+	glm::vec3 scale;
+};
+
+// Local transforms of every node of a skeleton
+typedef std::vector<Transform> Pose;
+
+// Same as translate(translation) * toMat4(rotation) * scale(scale), without the two matrix products
+glm::mat4 composeTransform(const Transform& transform)
+{
+	glm::mat3 rotation = glm::mat3_cast(transform.rotation);
+	glm::mat4 result;
+	result[0] = glm::vec4(rotation[0] * transform.scale.x, 0.0f);
+	result[1] = glm::vec4(rotation[1] * transform.scale.y, 0.0f);
+	result[2] = glm::vec4(rotation[2] * transform.scale.z, 0.0f);
+	result[3] = glm::vec4(transform.translation, 1.0f);
+	return result;
+}
+
+// Split an affine matrix without shear back into translation, rotation and scale
+Transform decomposeTransform(const glm::mat4& matrix)
+{
+	Transform result;
+	result.translation = glm::vec3(matrix[3]);
+	result.scale = glm::vec3(glm::length(glm::vec3(matrix[0])), glm::length(glm::vec3(matrix[1])), glm::length(glm::vec3(matrix[2])));
+	if (glm::determinant(glm::mat3(matrix)) < 0.0f)
+		result.scale.x = -result.scale.x;
+
+	glm::mat3 rotation(glm::vec3(matrix[0]) / result.scale.x, glm::vec3(matrix[1]) / result.scale.y, glm::vec3(matrix[2]) / result.scale.z);
+	result.rotation = glm::normalize(glm::quat_cast(rotation));
+	return result;
+}
+
+// a * b for matrices whose bottom row is (0, 0, 0, 1)
+glm::mat4 multiplyAffine(const glm::mat4& a, const glm::mat4& b)
+{
+	glm::mat4 result;
+	result[0] = a[0] * b[0].x + a[1] * b[0].y + a[2] * b[0].z;
+	result[1] = a[0] * b[1].x + a[1] * b[1].y + a[2] * b[1].z;
+	result[2] = a[0] * b[2].x + a[1] * b[2].y + a[2] * b[2].z;
+	result[3] = a[0] * b[3].x + a[1] * b[3].y + a[2] * b[3].z + a[3];
+	return result;
+}
+
+#endif
@@ -0,0 +1,226 @@
+#ifndef POSECACHE_HPP
+#define POSECACHE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "animation.hpp"
+
+struct PoseCacheStats
+{
+	size_t hits = 0;
+	size_t misses = 0;
+	size_t evictions = 0;
+	size_t entries = 0;
+	size_t bytes = 0;
+};
+
+// Local poses of clips at quantized times, shared by every animator using the cache. Crowds
+// playing the same clip at the same quantized time sample it once and copy it after that.
+// Sample times are rounded to a multiple of the quantum, so the quantum trades accuracy
+// against hits. The least recently used poses are dropped beyond maxBytes. Entries live in a
+// pool with an intrusive hash and recency list, and a dropped entry is reused with its pose
+// buffer, so once the cache is full misses no longer allocate. Safe to use from several
+// threads at once.
+class PoseCache
+{
+public:
+	// quantum in seconds, e.g. 1/30 to share all poses of a 30 fps clip
+	PoseCache(float quantumSeconds = 1.0f / 30.0f, size_t maxBytes = 4 * 1024 * 1024)
+	{
+		quantum = quantumSeconds;
+		capacity = maxBytes;
+		newest = oldest = -1;
+	}
+
+	// Bind pose with the clip applied at the quantized time closest to time (in ticks)
+	void samplePose(const Animation* animation, float time, Pose& pose, AnimationContext& context)
+	{
+		float step = quantum * animation->getTicksPerSecond();
+		int index = (int)(time / step + 0.5f);
+		if (index * step >= animation->getDuration())
+			index = 0;
+		Key key = { animation, index };
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			int found = find(key);
+			if (found != -1) {
+				unlinkUse(found);
+				linkUse(found);
+				pose = entries[found].pose;
+				stats.hits++;
+				return;
+			}
+			stats.misses++;
+		}
+
+		// Sample outside the lock, another thread may add the same pose meanwhile
+		pose = animation->getRestPose();
+		animation->sample(index * step, pose, context);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (find(key) != -1)
+			return;
+		size_t size = getEntryBytes(pose);
+		if (size > capacity)
+			return;
+		while (oldest != -1 && stats.bytes + size > capacity) {
+			int dropped = oldest;
+			unlinkUse(dropped);
+			unlinkBucket(dropped);
+			stats.bytes -= getEntryBytes(entries[dropped].pose);
+			freeEntries.push_back(dropped);
+			stats.evictions++;
+		}
+
+		int entry;
+		if (!freeEntries.empty()) {
+			entry = freeEntries.back();
+			freeEntries.pop_back();
+		}
+		else {
+			entry = (int)entries.size();
+			entries.push_back(Entry());
+			if (entries.size() > buckets.size())
+				rehash(std::max<size_t>(64, buckets.size() * 2));
+		}
+		entries[entry].key = key;
+		entries[entry].pose = pose;
+		linkUse(entry);
+		linkBucket(entry);
+		stats.bytes += size;
+		stats.entries = entries.size() - freeEntries.size();
+	}
+
+	PoseCacheStats getStats()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stats.entries = entries.size() - freeEntries.size();
+		return stats;
+	}
+
+	// Counters back to zero, the cached poses stay
+	void resetStats()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stats.hits = stats.misses = stats.evictions = 0;
+	}
+
+	// Drop every pose and release the memory of the pool, which clear() on the vectors would keep
+	void clear()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::vector<Entry>().swap(entries);
+		std::vector<int>().swap(freeEntries);
+		std::vector<int>().swap(buckets);
+		newest = oldest = -1;
+		stats.bytes = 0;
+		stats.entries = 0;
+	}
+
+	float getQuantum() const { return quantum; }
+
+	size_t getCapacity() const { return capacity; }
+
+private:
+	struct Key
+	{
+		const Animation* animation;
+		int index;
+
+		bool operator==(const Key& other) const { return animation == other.animation && index == other.index; }
+	};
+
+	struct Entry
+	{
+		Key key;
+		Pose pose;
+		// Neighbours in the recency list, from newest to oldest, and the next entry of the bucket
+		int newer = -1;
+		int older = -1;
+		int nextInBucket = -1;
+	};
+
+	float quantum;
+	size_t capacity;
+	std::mutex mutex;
+	std::vector<Entry> entries;
+	std::vector<int> freeEntries;
+	// First entry of each bucket, a power of two of them
+	std::vector<int> buckets;
+	int newest;
+	int oldest;
+	PoseCacheStats stats;
+
+	static size_t getEntryBytes(const Pose& pose) { return pose.size() * sizeof(Transform) + sizeof(Entry) + sizeof(int); }
+
+	size_t getBucket(const Key& key) const
+	{
+		size_t hash = std::hash<const void*>()(key.animation) ^ ((size_t)key.index * 0x9e3779b97f4a7c15ull);
+		return hash & (buckets.size() - 1);
+	}
+
+	int find(const Key& key) const
+	{
+		if (buckets.empty())
+			return -1;
+		for (int entry = buckets[getBucket(key)]; entry != -1; entry = entries[entry].nextInBucket) {
+			if (entries[entry].key == key)
+				return entry;
+		}
+		return -1;
+	}
+
+	void linkBucket(int entry)
+	{
+		int& first = buckets[getBucket(entries[entry].key)];
+		entries[entry].nextInBucket = first;
+		first = entry;
+	}
+
+	void unlinkBucket(int entry)
+	{
+		int* link = &buckets[getBucket(entries[entry].key)];
+		while (*link != entry)
+			link = &entries[*link].nextInBucket;
+		*link = entries[entry].nextInBucket;
+	}
+
+	void rehash(size_t bucketCount)
+	{
+		buckets.assign(bucketCount, -1);
+		for (int entry = newest; entry != -1; entry = entries[entry].older)
+			linkBucket(entry);
+	}
+
+	// Make the entry the newest
+	void linkUse(int entry)
+	{
+		entries[entry].newer = -1;
+		entries[entry].older = newest;
+		if (newest != -1)
+			entries[newest].newer = entry;
+		newest = entry;
+		if (oldest == -1)
+			oldest = entry;
+	}
+
+	void unlinkUse(int entry)
+	{
+		Entry& e = entries[entry];
+		if (e.newer != -1)
+			entries[e.newer].older = e.older;
+		else
+			newest = e.older;
+		if (e.older != -1)
+			entries[e.older].newer = e.newer;
+		else
+			oldest = e.newer;
+	}
+};
+
+#endif
@@ -0,0 +1,170 @@
+#ifndef SAMPLER_HPP
+#define SAMPLER_HPP
+
+#include <glm/glm.hpp>
+#include <glm/gtx/quaternion.hpp>
+
+#include <algorithm>
+#include <vector>
+
+#include "bone.hpp"
+#include "pose.hpp"
+#include "simd.hpp"
+
+// Key pairs of SIMD_LANES tracks, one float stream per component.
+// Components 0-2 hold the position, 3-6 the rotation and 7-9 the scale.
+struct SampleLanes
+{
+	alignas(SIMD_ALIGN) float factor[3][SIMD_LANES];
+	alignas(SIMD_ALIGN) float from[10][SIMD_LANES];
+	alignas(SIMD_ALIGN) float to[10][SIMD_LANES];
+	alignas(SIMD_ALIGN) float result[10][SIMD_LANES];
+};
+
+// Linear interpolation of count components for all lanes
+void lerpLanes(const float* factor, const float (*from)[SIMD_LANES], const float (*to)[SIMD_LANES], float (*result)[SIMD_LANES], int count)
+{
+	FloatLanes t = lanesLoad(factor);
+	for (int c = 0; c < count; c++)
+		lanesStore(result[c], lanesLerp(lanesLoad(from[c]), lanesLoad(to[c]), t));
+}
+
+// Normalized linear interpolation of quaternions (x, y, z, w). The keys are
+// expected in the same hemisphere, which Bone ensures at load time.
+void nlerpLanes(const float* factor, const float (*from)[SIMD_LANES], const float (*to)[SIMD_LANES], float (*result)[SIMD_LANES])
+{
+	FloatLanes t = lanesLoad(factor);
+	FloatLanes q[4];
+	FloatLanes lengthSquared = lanesSet(0.0f);
+	for (int c = 0; c < 4; c++) {
+		q[c] = lanesLerp(lanesLoad(from[c]), lanesLoad(to[c]), t);
+		lengthSquared = lanesAdd(lengthSquared, lanesMul(q[c], q[c]));
+	}
+
+	FloatLanes length = lanesSqrt(lengthSquared);
+	for (int c = 0; c < 4; c++)
+		lanesStore(result[c], lanesDiv(q[c], length));
+}
+
+// Reference path for quaternions, one lane at a time
+void slerpLanes(const float* factor, const float (*from)[SIMD_LANES], const float (*to)[SIMD_LANES], float (*result)[SIMD_LANES])
+{
+	for (int lane = 0; lane < SIMD_LANES; lane++)
+	{
+		glm::quat a(from[3][lane], from[0][lane], from[1][lane], from[2][lane]);
+		glm::quat b(to[3][lane], to[0][lane], to[1][lane], to[2][lane]);
+		glm::quat q = glm::normalize(glm::slerp(a, b, factor[lane]));
+		result[0][lane] = q.x;
+		result[1][lane] = q.y;
+		result[2][lane] = q.z;
+		result[3][lane] = q.w;
+	}
+}
+
+// Same as sampleBones(), but the key pairs are gathered per track and then SIMD_LANES tracks
+// are interpolated at once. Fetching the keys dominates and gathering them into lanes costs
+// more than the vector math saves, so this is slower than sampling track by track on the
+// clips measured by sampling_benchmark. Used by sampleBones() when SIMD_BATCH_SAMPLING is defined.
+void sampleBonesBatch(const std::vector<Bone>& bones, const std::vector<int>& trackNodes, const int* tracks, size_t trackCount,
+	float animationTime, RotationInterpolation rotationInterpolation, TrackCursor* cursors, Transform* pose)
+{
+	SampleLanes lanes;
+
+	for (size_t first = 0; first < trackCount; first += SIMD_LANES)
+	{
+		size_t count = std::min((size_t)SIMD_LANES, trackCount - first);
+
+		for (size_t lane = 0; lane < SIMD_LANES; lane++)
+		{
+			// Pad the last batch by repeating its final track
+			if (lane >= count) {
+				for (int c = 0; c < 3; c++)
+					lanes.factor[c][lane] = lanes.factor[c][count - 1];
+				for (int c = 0; c < 10; c++) {
+					lanes.from[c][lane] = lanes.from[c][count - 1];
+					lanes.to[c][lane] = lanes.to[c][count - 1];
+				}
+				continue;
+			}
+
+			int track = tracks ? tracks[first + lane] : (int)(first + lane);
+			const Bone& bone = bones[track];
+			TrackCursor& cursor = cursors[track];
+			glm::vec3 fromPosition, toPosition, fromScale, toScale;
+			glm::quat fromRotation, toRotation;
+			bone.getPositionKeys(animationTime, cursor.position, fromPosition, toPosition, lanes.factor[0][lane]);
+			bone.getRotationKeys(animationTime, cursor.rotation, fromRotation, toRotation, lanes.factor[1][lane]);
+			bone.getScaleKeys(animationTime, cursor.scale, fromScale, toScale, lanes.factor[2][lane]);
+
+			for (int c = 0; c < 3; c++) {
+				lanes.from[c][lane] = fromPosition[c];
+				lanes.to[c][lane] = toPosition[c];
+				lanes.from[7 + c][lane] = fromScale[c];
+				lanes.to[7 + c][lane] = toScale[c];
+			}
+			lanes.from[3][lane] = fromRotation.x;
+			lanes.from[4][lane] = fromRotation.y;
+			lanes.from[5][lane] = fromRotation.z;
+			lanes.from[6][lane] = fromRotation.w;
+			lanes.to[3][lane] = toRotation.x;
+			lanes.to[4][lane] = toRotation.y;
+			lanes.to[5][lane] = toRotation.z;
+			lanes.to[6][lane] = toRotation.w;
+		}
+
+		lerpLanes(lanes.factor[0], lanes.from, lanes.to, lanes.result, 3);
+		if (rotationInterpolation == NLERP)
+			nlerpLanes(lanes.factor[1], lanes.from + 3, lanes.to + 3, lanes.result + 3);
+		else
+			slerpLanes(lanes.factor[1], lanes.from + 3, lanes.to + 3, lanes.result + 3);
+		lerpLanes(lanes.factor[2], lanes.from + 7, lanes.to + 7, lanes.result + 7, 3);
+
+		for (size_t lane = 0; lane < count; lane++)
+		{
+			int node = trackNodes[tracks ? tracks[first + lane] : first + lane];
+			if (node == -1)
+				continue;
+
+			pose[node].translation = glm::vec3(lanes.result[0][lane], lanes.result[1][lane], lanes.result[2][lane]);
+			pose[node].rotation = glm::quat(lanes.result[6][lane], lanes.result[3][lane], lanes.result[4][lane], lanes.result[5][lane]);
+			pose[node].scale = glm::vec3(lanes.result[7][lane], lanes.result[8][lane], lanes.result[9][lane]);
+		}
+	}
+}
+
+// Sample the listed tracks (all of them when tracks is null) at animationTime into the pose
+// entry of their node, one track after the other. Only the cursors (one per track) are
+// written besides the pose.
+void sampleBones(const std::vector<Bone>& bones, const std::vector<int>& trackNodes, const int* tracks, size_t trackCount,
+	float animationTime, RotationInterpolation rotationInterpolation, TrackCursor* cursors, Transform* pose)
+{
+#ifdef SIMD_BATCH_SAMPLING
+	sampleBonesBatch(bones, trackNodes, tracks, trackCount, animationTime, rotationInterpolation, cursors, pose);
+#else
+	for (size_t i = 0; i < trackCount; i++)
+	{
+		int track = tracks ? tracks[i] : (int)i;
+		int node = trackNodes[track];
+		if (node == -1)
+			continue;
+
+		const Bone& bone = bones[track];
+		TrackCursor& cursor = cursors[track];
+		glm::vec3 fromPosition, toPosition, fromScale, toScale;
+		glm::quat fromRotation, toRotation;
+		float positionFactor, rotationFactor, scaleFactor;
+		bone.getPositionKeys(animationTime, cursor.position, fromPosition, toPosition, positionFactor);
+		bone.getRotationKeys(animationTime, cursor.rotation, fromRotation, toRotation, rotationFactor);
+		bone.getScaleKeys(animationTime, cursor.scale, fromScale, toScale, scaleFactor);
+
+		pose[node].translation = glm::mix(fromPosition, toPosition, positionFactor);
+		if (rotationInterpolation == NLERP)
+			pose[node].rotation = glm::normalize(fromRotation + (toRotation - fromRotation) * rotationFactor);
+		else
+			pose[node].rotation = glm::normalize(glm::slerp(fromRotation, toRotation, rotationFactor));
+		pose[node].scale = glm::mix(fromScale, toScale, scaleFactor);
+	}
+#endif
+}
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef SCHEDULER_HPP
+#define SCHEDULER_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "animator.hpp"
+
+// What the last frame of an AnimationScheduler did
+struct SchedulerStats
+{
+	int updated = 0;
+	int deferred = 0;
+	// Animation time in seconds the instances are behind, averaged and at worst
+	float averageStaleness = 0.0f;
+	float maxStaleness = 0.0f;
+	float elapsedMicroseconds = 0.0f;
+};
+
+// Spreads animator updates over frames so they fit a CPU budget. The most important
+// instances are updated first, the rest are deferred and later catch up on the time
+// they missed. Waiting raises the priority of an instance, and an instance deferred
+// for maxDeferredFrames is updated regardless of the budget.
+class AnimationScheduler
+{
+public:
+	AnimationScheduler(float budgetMicroseconds = 2000.0f, int maxDeferredFrames = 8)
+	{
+		budget = budgetMicroseconds;
+		maxDeferred = maxDeferredFrames;
+		averageCost = 0.0f;
+	}
+
+	// importance is relative to the other instances, e.g. screen size or gameplay relevance
+	int addInstance(Animator* animator, float importance = 1.0f)
+	{
+		instances.push_back({ animator, importance, 0.0f, 0 });
+		order.push_back((int)order.size());
+		return (int)instances.size() - 1;
+	}
+
+	void setImportance(int instance, float importance) { instances[instance].importance = importance; }
+
+	void setBudget(float budgetMicroseconds) { budget = budgetMicroseconds; }
+
+	float getBudget() const { return budget; }
+
+	const SchedulerStats& getStats() const { return stats; }
+
+	void update(float dt)
+	{
+		typedef std::chrono::high_resolution_clock Clock;
+		Clock::time_point start = Clock::now();
+
+		for (auto& instance : instances)
+			instance.pendingTime += dt;
+
+		std::sort(order.begin(), order.end(), [this](int a, int b) {
+			float priorityA = instances[a].importance * (instances[a].deferredFrames + 1);
+			float priorityB = instances[b].importance * (instances[b].deferredFrames + 1);
+			return priorityA != priorityB ? priorityA > priorityB : a < b;
+		});
+
+		stats = SchedulerStats();
+		float elapsed = 0.0f;
+		for (int index : order)
+		{
+			Instance& instance = instances[index];
+			// Stop before an update that is expected to overrun, except for starving instances
+			if (elapsed + averageCost > budget && instance.deferredFrames < maxDeferred) {
+				instance.deferredFrames++;
+				stats.deferred++;
+				continue;
+			}
+
+			Clock::time_point before = Clock::now();
+			instance.animator->updateAnimation(instance.pendingTime);
+			float cost = std::chrono::duration<float, std::micro>(Clock::now() - before).count();
+			averageCost = averageCost == 0.0f ? cost : averageCost + (cost - averageCost) * 0.1f;
+			elapsed = std::chrono::duration<float, std::micro>(Clock::now() - start).count();
+
+			instance.pendingTime = 0.0f;
+			instance.deferredFrames = 0;
+			stats.updated++;
+		}
+
+		for (auto& instance : instances) {
+			stats.averageStaleness += instance.pendingTime;
+			stats.maxStaleness = std::max(stats.maxStaleness, instance.pendingTime);
+		}
+		if (!instances.empty())
+			stats.averageStaleness /= instances.size();
+		stats.elapsedMicroseconds = std::chrono::duration<float, std::micro>(Clock::now() - start).count();
+	}
+
+private:
+	struct Instance
+	{
+		Animator* animator;
+		float importance;
+		// Time not yet applied to the animator, and frames since its last update
+		float pendingTime;
+		int deferredFrames;
+	};
+
+	std::vector<Instance> instances;
+	// Instances in order of priority, reused every frame
+	std::vector<int> order;
+	float budget;
+	int maxDeferred;
+	// Running average of the cost of one update in microseconds
+	float averageCost;
+	SchedulerStats stats;
+};
+
+#endif
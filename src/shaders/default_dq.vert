@@ -0,0 +1,102 @@
+#version 430 core
+
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+layout (location = 3) in vec3 aTangents;
+layout (location = 4) in vec3 aBitangents;
+layout (location = 5) in ivec4 boneIds; 
+layout (location = 6) in vec4 weights;
+
+layout (location = 0) uniform mat4 M;
+layout (location = 1) uniform mat4 V;
+layout (location = 2) uniform mat4 P;
+layout (location = 4) uniform uint type;
+
+out vec3 normal;
+out vec3 FragPos;
+out vec2 texCoords;
+out vec3 tangents;
+out vec3 bitangents;
+
+const int MAX_BONE_INFLUENCE = 4;
+
+// Palette of the character as unit dual quaternions, as many bones as the rig has: 8 floats
+// per bone, the real part then the dual part, each as x, y, z, w.
+layout (std430, binding = 0) readonly buffer BonePalette
+{
+    vec4 paletteQuats[];
+};
+
+int getBoneCount()
+{
+    return paletteQuats.length() / 2;
+}
+
+// Rotate v by the unit quaternion q
+vec3 rotate(vec4 q, vec3 v)
+{
+    return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
+
+// Translation of a unit dual quaternion
+vec3 getTranslation(vec4 real, vec4 dual)
+{
+    return 2.0 * (real.w * dual.xyz - dual.w * real.xyz + cross(real.xyz, dual.xyz));
+}
+
+void main()
+{
+    vec4 updatedPosition = vec4(0.0f);
+    vec3 updatedNormal = vec3(0.0f);
+
+    if(type == 5) {
+        // Blend the dual quaternions of the bones, then transform once
+        vec4 real = vec4(0.0f);
+        vec4 dual = vec4(0.0f);
+        vec4 first = vec4(0.0f);
+        bool outside = false;
+        for(int i = 0 ; i < MAX_BONE_INFLUENCE ; i++)
+        {
+            // Current bone-weight pair is non-existing
+            if(boneIds[i] == -1) 
+                continue;
+
+            // Ignore all bones outside the palette
+            if(boneIds[i] >= getBoneCount()) 
+            {
+                outside = true;
+                break;
+            }
+            vec4 boneReal = paletteQuats[boneIds[i] * 2];
+            vec4 boneDual = paletteQuats[boneIds[i] * 2 + 1];
+            // q and -q are the same transform, blend along the shortest path from the first bone
+            if (first == vec4(0.0f))
+                first = boneReal;
+            float weight = dot(boneReal, first) < 0.0f ? -weights[i] : weights[i];
+            real += boneReal * weight;
+            dual += boneDual * weight;
+        }
+
+        float magnitude = length(real);
+        if (outside || magnitude == 0.0f) {
+            updatedPosition = vec4(aPos, 1.0f);
+            updatedNormal = aNormal;
+        } else {
+            real /= magnitude;
+            dual /= magnitude;
+            updatedPosition = vec4(rotate(real, aPos) + getTranslation(real, dual), 1.0f);
+            updatedNormal = rotate(real, aNormal);
+        }
+    } else {
+        updatedPosition = vec4(aPos, 1.0f);
+        updatedNormal = aNormal;
+    }
+ 
+    gl_Position = P * V * M * updatedPosition;
+    FragPos = vec3(M * vec4(vec3(updatedPosition), 1.0));
+    normal = updatedNormal;
+    texCoords = aTexCoords;
+    tangents = aTangents;
+    bitangents = aBitangents;
+}
\ No newline at end of file
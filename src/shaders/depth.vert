@@ -7,9 +7,46 @@ layout (location = 1) uniform mat4 lightSpaceMatrix;
 layout (location = 0) uniform mat4 model;
 layout (location = 4) uniform uint type;
 
-const int MAX_BONES = 100;
 const int MAX_BONE_INFLUENCE = 4;
-uniform mat4 boneTransforms[MAX_BONES];
+
+layout (location = 10) uniform uint paletteFormat;
+
+// Palette of the character as 32 bit words, as many bones as the rig has. Laid out per
+// paletteFormat: 0 full matrices, 1 the top three rows, 2 those rows as half floats.
+layout (std430, binding = 0) readonly buffer BonePalette
+{
+    uint paletteWords[];
+};
+
+int getBoneCount()
+{
+    return paletteWords.length() / (paletteFormat == 0u ? 16 : paletteFormat == 1u ? 12 : 6);
+}
+
+mat4 getBoneTransform(int bone)
+{
+    if (paletteFormat == 0u) {
+        int base = bone * 16;
+        mat4 transform;
+        for (int column = 0; column < 4; column++)
+            transform[column] = uintBitsToFloat(uvec4(paletteWords[base + column * 4], paletteWords[base + column * 4 + 1],
+                paletteWords[base + column * 4 + 2], paletteWords[base + column * 4 + 3]));
+        return transform;
+    }
+
+    vec4 rows[3];
+    if (paletteFormat == 1u) {
+        int base = bone * 12;
+        for (int row = 0; row < 3; row++)
+            rows[row] = uintBitsToFloat(uvec4(paletteWords[base + row * 4], paletteWords[base + row * 4 + 1],
+                paletteWords[base + row * 4 + 2], paletteWords[base + row * 4 + 3]));
+    } else {
+        int base = bone * 6;
+        for (int row = 0; row < 3; row++)
+            rows[row] = vec4(unpackHalf2x16(paletteWords[base + row * 2]), unpackHalf2x16(paletteWords[base + row * 2 + 1]));
+    }
+    return transpose(mat4(rows[0], rows[1], rows[2], vec4(0.0, 0.0, 0.0, 1.0)));
+}
 
 void main()
 {
@@ -23,14 +60,15 @@ void main()
             if(boneIds[i] == -1) 
                 continue;
 
-            // Ignore all bones over count MAX_BONES
-            if(boneIds[i] >= MAX_BONES) 
+            // Ignore all bones outside the palette
+            if(boneIds[i] >= getBoneCount()) 
             {
                 updatedPosition = vec4(aPos,1.0f);
                 break;
             }
+            mat4 boneTransform = getBoneTransform(boneIds[i]);
             // Set pos
-            vec4 localPosition = boneTransforms[boneIds[i]] * vec4(aPos,1.0f);
+            vec4 localPosition = boneTransform * vec4(aPos,1.0f);
             updatedPosition += localPosition * weights[i];
         }
     } else {
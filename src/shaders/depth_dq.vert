@@ -0,0 +1,81 @@
+#version 430 core
+layout (location = 0) in vec3 aPos;
+layout (location = 5) in ivec4 boneIds; 
+layout (location = 6) in vec4 weights;
+
+layout (location = 1) uniform mat4 lightSpaceMatrix;
+layout (location = 0) uniform mat4 model;
+layout (location = 4) uniform uint type;
+
+const int MAX_BONE_INFLUENCE = 4;
+
+// Palette of the character as unit dual quaternions, as many bones as the rig has: 8 floats
+// per bone, the real part then the dual part, each as x, y, z, w.
+layout (std430, binding = 0) readonly buffer BonePalette
+{
+    vec4 paletteQuats[];
+};
+
+int getBoneCount()
+{
+    return paletteQuats.length() / 2;
+}
+
+// Rotate v by the unit quaternion q
+vec3 rotate(vec4 q, vec3 v)
+{
+    return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
+
+// Translation of a unit dual quaternion
+vec3 getTranslation(vec4 real, vec4 dual)
+{
+    return 2.0 * (real.w * dual.xyz - dual.w * real.xyz + cross(real.xyz, dual.xyz));
+}
+
+void main()
+{
+    vec4 updatedPosition = vec4(0.0f);
+    vec3 updatedNormal = vec3(0.0f);
+
+    if(type == 5) {
+        // Blend the dual quaternions of the bones, then transform once
+        vec4 real = vec4(0.0f);
+        vec4 dual = vec4(0.0f);
+        vec4 first = vec4(0.0f);
+        bool outside = false;
+        for(int i = 0 ; i < MAX_BONE_INFLUENCE ; i++)
+        {
+            // Current bone-weight pair is non-existing
+            if(boneIds[i] == -1) 
+                continue;
+
+            // Ignore all bones outside the palette
+            if(boneIds[i] >= getBoneCount()) 
+            {
+                outside = true;
+                break;
+            }
+            vec4 boneReal = paletteQuats[boneIds[i] * 2];
+            vec4 boneDual = paletteQuats[boneIds[i] * 2 + 1];
+            // q and -q are the same transform, blend along the shortest path from the first bone
+            if (first == vec4(0.0f))
+                first = boneReal;
+            float weight = dot(boneReal, first) < 0.0f ? -weights[i] : weights[i];
+            real += boneReal * weight;
+            dual += boneDual * weight;
+        }
+
+        float magnitude = length(real);
+        if (outside || magnitude == 0.0f) {
+            updatedPosition = vec4(aPos, 1.0f);
+        } else {
+            real /= magnitude;
+            dual /= magnitude;
+            updatedPosition = vec4(rotate(real, aPos) + getTranslation(real, dual), 1.0f);
+        }
+    } else {
+        updatedPosition = vec4(aPos, 1.0f);
+    }
+    gl_Position = lightSpaceMatrix * model * updatedPosition;
+}
\ No newline at end of file
@@ -0,0 +1,75 @@
+#ifndef SIMD_HPP
+#define SIMD_HPP
+
+// Thin wrappers over the widest float vector available at compile time.
+// Without SSE, or with SIMD_SCALAR defined, the lanes are processed one at a time.
+
+#if defined(__AVX__) && !defined(SIMD_SCALAR)
+
+#include <immintrin.h>
+
+#define SIMD_LANES 8
+#define SIMD_ALIGN 32
+
+typedef __m256 FloatLanes;
+
+inline FloatLanes lanesLoad(const float* p) { return _mm256_load_ps(p); }
+inline void lanesStore(float* p, FloatLanes a) { _mm256_store_ps(p, a); }
+inline FloatLanes lanesLoadUnaligned(const float* p) { return _mm256_loadu_ps(p); }
+inline void lanesStoreUnaligned(float* p, FloatLanes a) { _mm256_storeu_ps(p, a); }
+inline FloatLanes lanesSet(float v) { return _mm256_set1_ps(v); }
+inline FloatLanes lanesAdd(FloatLanes a, FloatLanes b) { return _mm256_add_ps(a, b); }
+inline FloatLanes lanesSub(FloatLanes a, FloatLanes b) { return _mm256_sub_ps(a, b); }
+inline FloatLanes lanesMul(FloatLanes a, FloatLanes b) { return _mm256_mul_ps(a, b); }
+inline FloatLanes lanesDiv(FloatLanes a, FloatLanes b) { return _mm256_div_ps(a, b); }
+inline FloatLanes lanesSqrt(FloatLanes a) { return _mm256_sqrt_ps(a); }
+
+#elif !defined(SIMD_SCALAR) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+
+#include <emmintrin.h>
+
+#define SIMD_LANES 4
+#define SIMD_ALIGN 16
+
+typedef __m128 FloatLanes;
+
+inline FloatLanes lanesLoad(const float* p) { return _mm_load_ps(p); }
+inline void lanesStore(float* p, FloatLanes a) { _mm_store_ps(p, a); }
+inline FloatLanes lanesLoadUnaligned(const float* p) { return _mm_loadu_ps(p); }
+inline void lanesStoreUnaligned(float* p, FloatLanes a) { _mm_storeu_ps(p, a); }
+inline FloatLanes lanesSet(float v) { return _mm_set1_ps(v); }
+inline FloatLanes lanesAdd(FloatLanes a, FloatLanes b) { return _mm_add_ps(a, b); }
+inline FloatLanes lanesSub(FloatLanes a, FloatLanes b) { return _mm_sub_ps(a, b); }
+inline FloatLanes lanesMul(FloatLanes a, FloatLanes b) { return _mm_mul_ps(a, b); }
+inline FloatLanes lanesDiv(FloatLanes a, FloatLanes b) { return _mm_div_ps(a, b); }
+inline FloatLanes lanesSqrt(FloatLanes a) { return _mm_sqrt_ps(a); }
+
+#else
+
+#include <cmath>
+
+#define SIMD_LANES 4
+#define SIMD_ALIGN 16
+
+struct FloatLanes
+{
+	float v[SIMD_LANES];
+};
+
+inline FloatLanes lanesLoad(const float* p) { FloatLanes r; for (int i = 0; i < SIMD_LANES; i++) r.v[i] = p[i]; return r; }
+inline void lanesStore(float* p, FloatLanes a) { for (int i = 0; i < SIMD_LANES; i++) p[i] = a.v[i]; }
+inline FloatLanes lanesLoadUnaligned(const float* p) { return lanesLoad(p); }
+inline void lanesStoreUnaligned(float* p, FloatLanes a) { lanesStore(p, a); }
+inline FloatLanes lanesSet(float v) { FloatLanes r; for (int i = 0; i < SIMD_LANES; i++) r.v[i] = v; return r; }
+inline FloatLanes lanesAdd(FloatLanes a, FloatLanes b) { for (int i = 0; i < SIMD_LANES; i++) a.v[i] += b.v[i]; return a; }
+inline FloatLanes lanesSub(FloatLanes a, FloatLanes b) { for (int i = 0; i < SIMD_LANES; i++) a.v[i] -= b.v[i]; return a; }
+inline FloatLanes lanesMul(FloatLanes a, FloatLanes b) { for (int i = 0; i < SIMD_LANES; i++) a.v[i] *= b.v[i]; return a; }
+inline FloatLanes lanesDiv(FloatLanes a, FloatLanes b) { for (int i = 0; i < SIMD_LANES; i++) a.v[i] /= b.v[i]; return a; }
+inline FloatLanes lanesSqrt(FloatLanes a) { for (int i = 0; i < SIMD_LANES; i++) a.v[i] = std::sqrt(a.v[i]); return a; }
+
+#endif
+
+// a + (b - a) * t
+inline FloatLanes lanesLerp(FloatLanes a, FloatLanes b, FloatLanes t) { return lanesAdd(a, lanesMul(lanesSub(b, a), t)); }
+
+#endif
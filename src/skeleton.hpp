@@ -0,0 +1,85 @@
+#ifndef SKELETON_HPP
+#define SKELETON_HPP
+
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+
+#include "pose.hpp"
+
+// Node hierarchy of a rig, flattened in depth-first order so that every
+// parent is stored before its children. Shared by all clips of the rig.
+struct Skeleton
+{
+	std::vector<std::string> names;
+	std::vector<int> parents;
+	std::vector<glm::mat4> localBindTransforms;
+	Pose bindPose;
+
+	int getNodeCount() const { return (int)parents.size(); }
+
+	int findNode(const std::string& name) const
+	{
+		for (unsigned int i = 0; i < names.size(); i++) {
+			if (names[i] == name)
+				return i;
+		}
+		return -1;
+	}
+
+	// Mask over all nodes that is set for the node and everything below it, e.g. the spine
+	// for an upper-body layer
+	std::vector<bool> getSubtreeMask(int node) const
+	{
+		std::vector<bool> mask(parents.size(), false);
+		if (node == -1)
+			return mask;
+		mask[node] = true;
+		for (int child = node + 1; child < getNodeCount(); child++) {
+			if (parents[child] != -1 && mask[parents[child]])
+				mask[child] = true;
+		}
+		return mask;
+	}
+
+	// Object space distance from each node to its farthest descendant in the bind pose,
+	// which bounds how far a rotation of the node moves the rest of its chain. Leaves
+	// use the length of their own bone instead, as a rough extent of their skinned vertices.
+	std::vector<float> getNodeReach() const
+	{
+		std::vector<glm::mat4> globals(localBindTransforms.size());
+		std::vector<float> reach(localBindTransforms.size(), 0.0f);
+		for (int node = 0; node < getNodeCount(); node++) {
+			int parent = parents[node];
+			globals[node] = parent == -1 ? localBindTransforms[node] : globals[parent] * localBindTransforms[node];
+			glm::vec3 position(globals[node][3]);
+			for (int ancestor = parent; ancestor != -1; ancestor = parents[ancestor])
+				reach[ancestor] = glm::max(reach[ancestor], glm::length(position - glm::vec3(globals[ancestor][3])));
+		}
+		for (int node = 0; node < getNodeCount(); node++) {
+			if (reach[node] == 0.0f && parents[node] != -1)
+				reach[node] = glm::length(glm::vec3(globals[node][3]) - glm::vec3(globals[parents[node]][3]));
+		}
+		return reach;
+	}
+
+	// Number of nodes on the longest root to leaf path through each node
+	std::vector<int> getNodeChainLength() const
+	{
+		std::vector<int> depth(parents.size(), 0), height(parents.size(), 0);
+		for (int node = 1; node < getNodeCount(); node++)
+			depth[node] = parents[node] == -1 ? 0 : depth[parents[node]] + 1;
+		for (int node = getNodeCount() - 1; node > 0; node--) {
+			if (parents[node] != -1)
+				height[parents[node]] = glm::max(height[parents[node]], height[node] + 1);
+		}
+
+		std::vector<int> length(parents.size());
+		for (int node = 0; node < getNodeCount(); node++)
+			length[node] = depth[node] + height[node] + 1;
+		return length;
+	}
+};
+
+#endif
@@ -0,0 +1,165 @@
+// Runs each way of playing clips until warmed up, then fails if any further frame allocates.
+// Every allocation of the process goes through the counting operator new below, including
+// the ones of worker threads.
+
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <new>
+
+std::atomic<size_t> allocationCount(0);
+
+void* operator new(size_t size)
+{
+	allocationCount++;
+	void* memory = std::malloc(size ? size : 1);
+	if (!memory)
+		throw std::bad_alloc();
+	return memory;
+}
+
+void operator delete(void* memory) noexcept { std::free(memory); }
+void operator delete(void* memory, size_t) noexcept { std::free(memory); }
+
+#include "headless.hpp"
+#include "animation.hpp"
+#include "animator.hpp"
+#include "animationworld.hpp"
+#include "blendspace.hpp"
+#include "posecache.hpp"
+#include "scheduler.hpp"
+
+const int WARMUP_FRAMES = 600;
+const int MEASURED_FRAMES = 1200;
+const float FRAME_TIME = 1.0f / 60.0f;
+
+int failures = 0;
+
+// Run frames 0 to WARMUP_FRAMES untracked, then count the allocations of the rest
+void expectNoAllocations(const char* name, const std::function<void(int)>& frame)
+{
+	for (int i = 0; i < WARMUP_FRAMES; i++)
+		frame(i);
+	size_t before = allocationCount.load();
+	for (int i = WARMUP_FRAMES; i < WARMUP_FRAMES + MEASURED_FRAMES; i++)
+		frame(i);
+	size_t allocations = allocationCount.load() - before;
+	std::cout << (allocations == 0 ? "ok    " : "FAILED") << " " << name << ": " << allocations << " allocations in " << MEASURED_FRAMES << " frames" << std::endl;
+	if (allocations != 0)
+		failures++;
+}
+
+int main(int argc, char** argv)
+{
+	useHeadlessTextures();
+	std::string directory = getResourceDirectory(argc, argv);
+	vector<TextureOverride> overrides;
+	Model model(directory + "aj.dae", overrides);
+	std::vector<std::unique_ptr<Animation>> clips;
+	for (const std::string& file : CLIP_FILES)
+		clips.push_back(std::unique_ptr<Animation>(new Animation(directory + file, &model)));
+	Animation* idle = clips[0].get();
+	Animation* walking = clips[1].get();
+	Animation* jump = clips[5].get();
+
+	Animator clip;
+	clip.playAnimation(walking);
+	expectNoAllocations("clip", [&](int) { clip.updateAnimation(FRAME_TIME); });
+
+	Animator crossfade;
+	expectNoAllocations("crossfade switching", [&](int i) {
+		crossfade.playAnimation(clips[1 + (i / 15) % 4].get());
+		crossfade.updateAnimation(FRAME_TIME);
+	});
+
+	Animator inertialized;
+	inertialized.setTransitionMode(INERTIALIZE);
+	expectNoAllocations("inertialized switching", [&](int i) {
+		inertialized.playAnimation(clips[1 + (i / 15) % 4].get());
+		inertialized.updateAnimation(FRAME_TIME);
+	});
+
+	BlendSpace locomotion;
+	locomotion.addSample(idle, glm::vec2(0.0f, 0.0f), false);
+	locomotion.addSample(walking, glm::vec2(0.0f, 0.75f));
+	locomotion.addSample(clips[2].get(), glm::vec2(-0.75f, 0.0f));
+	locomotion.addSample(clips[3].get(), glm::vec2(0.75f, 0.0f));
+	locomotion.addSample(clips[4].get(), glm::vec2(0.0f, -0.5f));
+	locomotion.triangulate();
+	Animator blended;
+	expectNoAllocations("blend space and jumps", [&](int i) {
+		blended.setBlendParameter(glm::vec2(std::sin(i * 0.05f), std::cos(i * 0.03f)) * 0.7f);
+		if ((i / 100) % 3 == 2)
+			blended.playAnimation(jump);
+		else
+			blended.playBlendSpace(&locomotion);
+		blended.updateAnimation(FRAME_TIME);
+	});
+
+	Animator layered;
+	layered.playAnimation(walking);
+	layered.addLayer(idle, idle->getSkeleton()->getSubtreeMask(idle->getSkeleton()->findNode("Spine")), 0.5f);
+	expectNoAllocations("layer", [&](int) { layered.updateAnimation(FRAME_TIME); });
+
+	Animator detail;
+	detail.playAnimation(walking);
+	expectNoAllocations("level of detail and culling", [&](int i) {
+		detail.setLod((AnimationLod)((i / 30) % 4));
+		detail.setCulled((i / 200) % 2 == 1);
+		detail.updateAnimation(FRAME_TIME);
+	});
+
+	AnimationContext context;
+	int hand = walking->getSkeleton()->findNode("LeftHand");
+	expectNoAllocations("node query", [&](int i) { walking->getNodeTransform(hand, i * 0.01f, context); });
+
+	// While a blend space plays, after a jump left its clip as the current one
+	Animator queried;
+	queried.playAnimation(jump);
+	queried.updateAnimation(FRAME_TIME);
+	queried.playBlendSpace(&locomotion);
+	glm::mat4 handTransform;
+	bool identity = true;
+	expectNoAllocations("node query during a blend space", [&](int i) {
+		queried.setBlendParameter(glm::vec2(std::sin(i * 0.05f), std::cos(i * 0.03f)) * 0.7f);
+		queried.updateAnimation(FRAME_TIME);
+		queried.queryNodeTransforms(&hand, 1, i * 0.01f, &handTransform);
+		identity = identity && handTransform == glm::mat4(1.0f);
+	});
+	if (!identity) {
+		std::cout << "FAILED node query during a blend space: transforms of a clip that is not playing" << std::endl;
+		failures++;
+	}
+
+	// Every clip of the world fits the cache after warming up
+	PoseCache cache;
+	AnimationWorld world(32, 2);
+	world.setPoseCache(&cache);
+	for (int i = 0; i < 32; i++)
+		world.getAnimator(world.addAnimator()).playAnimation(clips[i % 2].get());
+	expectNoAllocations("world with a pose cache", [&](int) { world.updateAnimations(FRAME_TIME); });
+
+	// Far too small for the clips, so the cache keeps dropping poses
+	PoseCache smallCache(1.0f / 30.0f, 64 * 1024);
+	AnimationWorld crowdedWorld(32, 2);
+	crowdedWorld.setPoseCache(&smallCache);
+	for (int i = 0; i < 32; i++)
+		crowdedWorld.getAnimator(crowdedWorld.addAnimator()).playAnimation(clips[i % 6].get());
+	expectNoAllocations("world with an evicting pose cache", [&](int) { crowdedWorld.updateAnimations(FRAME_TIME); });
+
+	AnimationScheduler scheduler(100.0f);
+	Animator scheduled[8];
+	for (int i = 0; i < 8; i++) {
+		scheduled[i].playAnimation(clips[i % 6].get());
+		scheduler.addInstance(&scheduled[i]);
+	}
+	expectNoAllocations("scheduler", [&](int) { scheduler.update(FRAME_TIME); });
+
+	if (failures > 0) {
+		std::cout << failures << " cases allocated after warming up" << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,46 @@
+#ifndef HEADLESS_HPP
+#define HEADLESS_HPP
+
+#include <glad/glad.h>
+
+#include <string>
+#include <vector>
+
+#include "model.hpp"
+
+// Models upload their textures while loading. Without a GL context the texture calls are
+// replaced by ones that only hand out names, so clips and meshes load on machines without a GPU.
+static void APIENTRY headlessGenTextures(GLsizei count, GLuint* textures)
+{
+	static GLuint next = 1;
+	for (GLsizei i = 0; i < count; i++)
+		textures[i] = next++;
+}
+static void APIENTRY headlessBindTexture(GLenum, GLuint) {}
+static void APIENTRY headlessTexImage2D(GLenum, GLint, GLint, GLsizei, GLsizei, GLint, GLenum, GLenum, const void*) {}
+static void APIENTRY headlessGenerateMipmap(GLenum) {}
+static void APIENTRY headlessTexParameteri(GLenum, GLenum, GLint) {}
+
+void useHeadlessTextures()
+{
+	glad_glGenTextures = headlessGenTextures;
+	glad_glBindTexture = headlessBindTexture;
+	glad_glTexImage2D = headlessTexImage2D;
+	glad_glGenerateMipmap = headlessGenerateMipmap;
+	glad_glTexParameteri = headlessTexParameteri;
+}
+
+// Directory holding aj.dae and its clips, the first argument or the one next to the build directory
+std::string getResourceDirectory(int argc, char** argv)
+{
+	std::string directory = argc > 1 ? argv[1] : "../res/aj";
+	if (!directory.empty() && directory.back() != '/')
+		directory += '/';
+	return directory;
+}
+
+// Clip files of aj.dae, in the order main loads them
+const std::vector<std::string> CLIP_FILES = { "breathing_idle.dae", "walking.dae", "right_strafe_walking.dae",
+	"left_strafe_walking.dae", "walking_backwards.dae", "jump.dae" };
+
+#endif
@@ -0,0 +1,118 @@
+// Key lookup on a long clip: the linear scan from the first key that Bone used to do, against
+// findKeyIndex() with a cursor kept across frames (forward playback) and with random seeks
+// (binary search). Then whole clip sampling in the same two playback patterns.
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+
+#include "headless.hpp"
+#include "animation.hpp"
+
+typedef std::chrono::high_resolution_clock Clock;
+
+const int LOOPS = 20;
+const float FRAME_RATE = 60.0f;
+
+// Key pair surrounding animationTime, searched from the first key every time
+size_t findKeyIndexLinear(const std::vector<float>& times, float animationTime)
+{
+	for (size_t index = 0; index + 1 < times.size(); ++index)
+	{
+		if (animationTime < times[index + 1])
+			return index;
+	}
+	return times.size() - 2;
+}
+
+double getNanoseconds(Clock::time_point start, size_t count)
+{
+	return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / count;
+}
+
+int main(int argc, char** argv)
+{
+	std::string directory = getResourceDirectory(argc, argv);
+	std::string clipFile = argc > 2 ? argv[2] : "breathing_idle.dae";
+
+	// Timestamps of every channel with more than one key, as loaded
+	Assimp::Importer importer;
+	const aiScene* scene = importer.ReadFile(directory + clipFile, 0);
+	if (!scene || scene->mNumAnimations == 0) {
+		std::cout << "Could not load " << directory + clipFile << std::endl;
+		return 1;
+	}
+	const aiAnimation* clip = scene->mAnimations[0];
+	float duration = (float)clip->mDuration;
+	float ticksPerSecond = clip->mTicksPerSecond > 0.0 ? (float)clip->mTicksPerSecond : 1.0f;
+	std::vector<std::vector<float>> channels;
+	size_t keyCount = 0;
+	for (unsigned int i = 0; i < clip->mNumChannels; i++) {
+		const aiNodeAnim* channel = clip->mChannels[i];
+		std::vector<float> times;
+		for (unsigned int key = 0; key < channel->mNumRotationKeys; key++)
+			times.push_back((float)channel->mRotationKeys[key].mTime);
+		keyCount += times.size();
+		if (times.size() > 1)
+			channels.push_back(times);
+	}
+
+	// Frame times of forward playback, and the same times shuffled as seeks
+	std::vector<float> forward;
+	for (int loop = 0; loop < LOOPS; loop++)
+		for (float time = 0.0f; time < duration; time += ticksPerSecond / FRAME_RATE)
+			forward.push_back(time);
+	std::vector<float> seeks = forward;
+	std::srand(1);
+	for (size_t i = seeks.size() - 1; i > 0; i--)
+		std::swap(seeks[i], seeks[std::rand() % (i + 1)]);
+	size_t lookups = forward.size() * channels.size();
+
+	std::cout << clipFile << ": " << channels.size() << " keyed channels, " << keyCount << " rotation keys, "
+		<< forward.size() << " frames" << std::endl;
+
+	size_t checksum[3] = { 0, 0, 0 };
+	Clock::time_point start = Clock::now();
+	for (float time : forward)
+		for (const std::vector<float>& times : channels)
+			checksum[0] += findKeyIndexLinear(times, time);
+	std::cout << "linear scan:        " << getNanoseconds(start, lookups) << " ns per lookup" << std::endl;
+
+	std::vector<size_t> cursors(channels.size(), 0);
+	start = Clock::now();
+	for (float time : forward)
+		for (size_t c = 0; c < channels.size(); c++)
+			checksum[1] += findKeyIndex(channels[c], time, cursors[c]);
+	std::cout << "cursor, forward:    " << getNanoseconds(start, lookups) << " ns per lookup" << std::endl;
+
+	start = Clock::now();
+	for (float time : seeks)
+		for (size_t c = 0; c < channels.size(); c++)
+			checksum[2] += findKeyIndex(channels[c], time, cursors[c]);
+	std::cout << "cursor, seeking:    " << getNanoseconds(start, lookups) << " ns per lookup" << std::endl;
+
+	if (checksum[0] != checksum[1] || checksum[0] != checksum[2]) {
+		std::cout << "Lookups disagree" << std::endl;
+		return 1;
+	}
+
+	// The whole clip, as animators sample it
+	useHeadlessTextures();
+	vector<TextureOverride> overrides;
+	Model model(directory + "aj.dae", overrides);
+	Animation animation(directory + clipFile, &model);
+	Pose pose = animation.getRestPose();
+	AnimationContext context;
+	start = Clock::now();
+	for (float time : forward)
+		animation.sample(time, pose, context);
+	std::cout << "clip sample, forward: " << getNanoseconds(start, forward.size()) / 1000.0 << " us" << std::endl;
+	start = Clock::now();
+	for (float time : seeks)
+		animation.sample(time, pose, context);
+	std::cout << "clip sample, seeking: " << getNanoseconds(start, seeks.size()) / 1000.0 << " us" << std::endl;
+	return 0;
+}
@@ -0,0 +1,106 @@
+// Batch sampling of every track of a clip with sampleBonesBatch(), SIMD_LANES tracks at a
+// time, against sampleBones() interpolating each track on its own with glm. Built once per
+// instruction set: sampling_benchmark for the default target (SSE2 on x86-64),
+// sampling_benchmark_avx and sampling_benchmark_scalar for the fallback of simd.hpp. Every
+// clip is sampled with its float keys and compressed, see ImportSettings::compress.
+
+#include <chrono>
+#include <iostream>
+
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+
+#include "headless.hpp"
+#include "sampler.hpp"
+
+typedef std::chrono::high_resolution_clock Clock;
+
+const int LOOPS = 20;
+const float FRAME_RATE = 60.0f;
+
+#if defined(SIMD_SCALAR)
+const char* INSTRUCTION_SET = "scalar fallback";
+#elif defined(__AVX__)
+const char* INSTRUCTION_SET = "AVX";
+#else
+const char* INSTRUCTION_SET = "SSE2";
+#endif
+
+float getPoseDifference(const Pose& a, const Pose& b)
+{
+	float difference = 0.0f;
+	for (size_t i = 0; i < a.size(); i++) {
+		difference = glm::max(difference, glm::length(a[i].translation - b[i].translation));
+		difference = glm::max(difference, glm::length(glm::vec4(a[i].rotation.x - b[i].rotation.x, a[i].rotation.y - b[i].rotation.y,
+			a[i].rotation.z - b[i].rotation.z, a[i].rotation.w - b[i].rotation.w)));
+		difference = glm::max(difference, glm::length(a[i].scale - b[i].scale));
+	}
+	return difference;
+}
+
+int main(int argc, char** argv)
+{
+	std::string directory = getResourceDirectory(argc, argv);
+	std::cout << INSTRUCTION_SET << ", " << SIMD_LANES << " lanes" << std::endl;
+
+	for (const std::string& file : CLIP_FILES)
+	{
+		Assimp::Importer importer;
+		const aiScene* scene = importer.ReadFile(directory + file, 0);
+		if (!scene || scene->mNumAnimations == 0) {
+			std::cout << "Could not load " << directory + file << std::endl;
+			return 1;
+		}
+		const aiAnimation* clip = scene->mAnimations[0];
+		float duration = (float)clip->mDuration;
+		float ticksPerSecond = clip->mTicksPerSecond > 0.0 ? (float)clip->mTicksPerSecond : 1.0f;
+
+		// One pose entry per track, with the keys as loaded and compressed
+		std::vector<Bone> storages[2];
+		std::vector<int> trackNodes;
+		ImportSettings compressed;
+		compressed.compress = true;
+		for (unsigned int i = 0; i < clip->mNumChannels; i++) {
+			storages[0].push_back(Bone(clip->mChannels[i]->mNodeName.data, i, clip->mChannels[i]));
+			storages[1].push_back(Bone(clip->mChannels[i]->mNodeName.data, i, clip->mChannels[i], duration, ticksPerSecond, compressed));
+			trackNodes.push_back(i);
+		}
+
+		std::vector<float> times;
+		for (int loop = 0; loop < LOOPS; loop++)
+			for (float time = 0.0f; time < duration; time += ticksPerSecond / FRAME_RATE)
+				times.push_back(time);
+		size_t samples = times.size() * trackNodes.size();
+
+		const RotationInterpolation modes[] = { NLERP, SLERP };
+		for (int storage = 0; storage < 2; storage++)
+		for (RotationInterpolation mode : modes)
+		{
+			const std::vector<Bone>& bones = storages[storage];
+			Pose batchPose(bones.size()), trackPose(bones.size());
+			std::vector<TrackCursor> batchCursors(bones.size()), trackCursors(bones.size());
+			float difference = 0.0f;
+
+			Clock::time_point start = Clock::now();
+			for (float time : times)
+				sampleBonesBatch(bones, trackNodes, nullptr, bones.size(), time, mode, batchCursors.data(), batchPose.data());
+			double batch = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / samples;
+
+			start = Clock::now();
+			for (float time : times)
+				sampleBones(bones, trackNodes, nullptr, bones.size(), time, mode, trackCursors.data(), trackPose.data());
+			double single = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / samples;
+
+			// Same keys, so both agree up to rounding
+			for (size_t i = 0; i < times.size(); i += 97) {
+				sampleBonesBatch(bones, trackNodes, nullptr, bones.size(), times[i], mode, batchCursors.data(), batchPose.data());
+				sampleBones(bones, trackNodes, nullptr, bones.size(), times[i], mode, trackCursors.data(), trackPose.data());
+				difference = glm::max(difference, getPoseDifference(batchPose, trackPose));
+			}
+
+			std::cout << file << " " << (storage == 0 ? "float keys" : "compressed keys") << ", " << (mode == NLERP ? "nlerp" : "slerp") << ": batch " << batch << " ns per track, per track "
+				<< single << " ns, largest difference " << difference << std::endl;
+		}
+	}
+	return 0;
+}
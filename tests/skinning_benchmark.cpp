@@ -0,0 +1,85 @@
+// CPU skinning of the character in a pose of the walking clip: vertices skinned per second
+// for a growing number of threads, and the skinned vertices against the math of default.vert
+// done one vertex at a time with glm.
+
+#include <iostream>
+#include <thread>
+
+#include "headless.hpp"
+#include "animation.hpp"
+#include "animator.hpp"
+#include "cpuskinning.hpp"
+
+const int RUNS = 100;
+const float TOLERANCE = 1e-3f;
+
+// default.vert for one vertex: the palette matrices of its bones weighted and applied one by
+// one, the bind pose once a bone is outside the palette. Positions are divided by the w the
+// shader leaves in gl_Position.
+void skinVertexReference(const Mesh& mesh, const glm::mat4* palette, int boneCount, size_t vertex, glm::vec3& position, glm::vec3& normal)
+{
+	glm::vec4 updatedPosition(0.0f);
+	glm::vec3 updatedNormal(0.0f);
+	for (int i = 0; i < 4; i++)
+	{
+		int bone = mesh.boneIDs[vertex][i];
+		if (bone == -1)
+			continue;
+		if (bone >= boneCount) {
+			position = mesh.vertices[vertex];
+			normal = mesh.normals[vertex];
+			return;
+		}
+		updatedPosition += palette[bone] * glm::vec4(mesh.vertices[vertex], 1.0f) * mesh.weights[vertex][i];
+		updatedNormal += glm::mat3(palette[bone]) * mesh.normals[vertex] * mesh.weights[vertex][i];
+	}
+	position = updatedPosition.w != 0.0f ? glm::vec3(updatedPosition) / updatedPosition.w : glm::vec3(updatedPosition);
+	normal = updatedNormal;
+}
+
+int main(int argc, char** argv)
+{
+	useHeadlessTextures();
+	std::string directory = getResourceDirectory(argc, argv);
+	vector<TextureOverride> overrides;
+	Model model(directory + "aj.dae", overrides);
+	Animation walking(directory + CLIP_FILES[1], &model);
+	Animator animator;
+	animator.playAnimation(&walking);
+	animator.updateAnimation(0.5f);
+	const glm::mat4* palette = animator.getPalette();
+	int boneCount = (int)model.boneProps.size();
+
+	bool matches = true;
+	for (const Mesh& mesh : model.meshes)
+	{
+		SkinnedMesh result;
+		CpuSkinner(1).skin(mesh, palette, boneCount, result);
+		float positionError = 0.0f, normalError = 0.0f;
+		for (size_t vertex = 0; vertex < mesh.vertices.size(); vertex++) {
+			glm::vec3 position, normal;
+			skinVertexReference(mesh, palette, boneCount, vertex, position, normal);
+			positionError = glm::max(positionError, glm::length(position - result.vertices[vertex]));
+			normalError = glm::max(normalError, glm::length(normal - result.normals[vertex]));
+		}
+		std::cout << mesh.vertices.size() << " vertices, largest difference to default.vert: position " << positionError
+			<< ", normal " << normalError << std::endl;
+		matches = matches && positionError <= TOLERANCE && normalError <= TOLERANCE;
+
+		unsigned int hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+		for (unsigned int threads = 1; ; threads *= 2) {
+			threads = std::min(threads, hardwareThreads);
+			CpuSkinner skinner(threads);
+			double rate = skinner.measureThroughput(mesh, palette, boneCount, RUNS);
+			std::cout << "  " << skinner.getThreadCount() << " threads: " << rate / 1e6 << " million vertices per second" << std::endl;
+			if (threads == hardwareThreads)
+				break;
+		}
+	}
+
+	if (!matches) {
+		std::cout << "Skinned vertices differ from default.vert by more than " << TOLERANCE << std::endl;
+		return 1;
+	}
+	return 0;
+}